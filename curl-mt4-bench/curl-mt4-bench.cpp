@@ -0,0 +1,902 @@
+﻿// curl-mt4-bench.cpp : Loopback benchmark of the curl-mt4 exported API.
+//
+// Starts an in-process HTTP/1.1 server on 127.0.0.1 and measures latency of
+// CurlExecute / CurlGetData / CurlGetDataW while sweeping response body size,
+// header count, method and debug level. Results are written as JSON.
+//
+// With --ws-echo it instead runs a WebSocket round trip (text, binary, ping/
+// pong, close in both directions and a protocol error) against the same server.
+// With --stress it runs threads sharing a handle, cancelling each other's
+// requests, and making asynchronous and coalesced requests (run it in a
+// -DCURLMT4_SANITIZE=thread build to check the thread safety contract).
+
+#define _CRT_SECURE_NO_WARNINGS
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+using sock_t = SOCKET;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using sock_t = int;
+#define INVALID_SOCKET (-1)
+#define closesocket    close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL   0               // No SIGPIPE on Windows and macOS uses SO_NOSIGPIPE
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <curl/curl.h>
+#include <curl-mt4.h>
+
+//------------------------------------------------------------------------------
+// Sec-WebSocket-Accept of a handshake key: base64(SHA-1(key + GUID)). Written
+// independently of the client's code so that the round trip checks it
+//------------------------------------------------------------------------------
+static std::string WsAccept(const std::string& key)
+{
+    std::string msg = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint64_t    bits = uint64_t(msg.size()) * 8;
+    msg.push_back('\x80');
+    while (msg.size() % 64 != 56) msg.push_back('\0');
+    for (int i = 7; i >= 0; --i) msg.push_back(char(bits >> (i*8)));
+
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    for (size_t blk = 0; blk < msg.size(); blk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            auto b = reinterpret_cast<const uint8_t*>(&msg[blk + size_t(i)*4]);
+            w[i] = uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+        }
+        for (int i = 16; i < 80; ++i)
+            w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if      (i < 20) { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            auto t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    uint8_t digest[21] = {};
+    for (int i = 0; i < 20; ++i) digest[i] = uint8_t(h[i/4] >> (24 - (i%4)*8));
+
+    static const char s_b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (int i = 0; i < 20; i += 3) {
+        uint32_t v = uint32_t(digest[i]) << 16 | uint32_t(digest[i+1]) << 8 | (i+2 < 20 ? digest[i+2] : 0);
+        out.push_back(s_b64[(v >> 18) & 63]);
+        out.push_back(s_b64[(v >> 12) & 63]);
+        out.push_back(s_b64[(v >>  6) & 63]);
+        out.push_back(i+2 < 20 ? s_b64[v & 63] : '=');
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+// Minimal HTTP/1.1 server with keep-alive. The response is shaped by the
+// query string of the request URL: `size=N` bytes of body, `hdrs=M`
+// extra response headers and `delay=MS` before responding. A WebSocket upgrade request turns the connection
+// into an echo server, see ServeWebSocket().
+//------------------------------------------------------------------------------
+class LoopbackServer
+{
+public:
+    LoopbackServer()
+        : m_listener(INVALID_SOCKET), m_port(0), m_stop(false), m_requests(0)
+        , m_ws_closes(0), m_ws_close_code(0)
+    {}
+    ~LoopbackServer() { Stop(); }
+
+    bool Start()
+    {
+#ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+        m_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (m_listener == INVALID_SOCKET) return false;
+
+        int on = 1;
+        setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+
+        sockaddr_in addr{};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port        = 0;
+        if (bind(m_listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_listener, 64) != 0)
+            return false;
+
+        socklen_t len = sizeof(addr);
+        getsockname(m_listener, (sockaddr*)&addr, &len);
+        m_port   = ntohs(addr.sin_port);
+        m_thread = std::thread([this] { Accept(); });
+        return true;
+    }
+
+    void Stop()
+    {
+        if (m_stop.exchange(true)) return;
+        if (m_listener != INVALID_SOCKET) {
+#ifdef _WIN32
+            shutdown(m_listener, SD_BOTH);
+#else
+            shutdown(m_listener, SHUT_RDWR);
+#endif
+            closesocket(m_listener);
+        }
+        if (m_thread.joinable()) m_thread.join();
+
+        std::lock_guard<std::mutex> g(m_mtx);
+        for (auto s : m_clients) {
+#ifdef _WIN32
+            shutdown(s, SD_BOTH);
+#else
+            shutdown(s, SHUT_RDWR);
+#endif
+        }
+        for (auto& t : m_workers) t.join();
+        for (auto s : m_clients)  closesocket(s);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    int Port()     const { return m_port; }
+    /// HTTP requests served
+    int Requests() const { return m_requests.load(); }
+    /// Close frames received from WebSocket clients
+    int WsCloses() const { return m_ws_closes.load(); }
+    /// Status code of the last close frame received
+    int WsCloseCode() const { return m_ws_close_code.load(); }
+
+private:
+    void Accept()
+    {
+        while (!m_stop) {
+            auto s = accept(m_listener, nullptr, nullptr);
+            if (s == INVALID_SOCKET) break;
+            int on = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+            std::lock_guard<std::mutex> g(m_mtx);
+            m_clients.push_back(s);
+            m_workers.emplace_back([this, s] { Serve(s); });
+        }
+    }
+
+    static size_t QueryParam(const std::string& path, const char* name)
+    {
+        auto key = std::string(name) + "=";
+        auto p   = path.find(key);
+        return p == std::string::npos ? 0 : strtoul(path.c_str() + p + key.size(), nullptr, 10);
+    }
+
+    static bool SendAll(sock_t s, const char* p, size_t n)
+    {
+        while (n) {
+            auto k = send(s, p, int(std::min<size_t>(n, 1 << 20)), MSG_NOSIGNAL);
+            if (k <= 0) return false;
+            p += k;
+            n -= size_t(k);
+        }
+        return true;
+    }
+
+    /// Serve requests on a connection until it's closed. The socket itself is
+    /// closed in Stop(), after all workers are joined
+    void Serve(sock_t s)
+    {
+        std::string buf;
+        std::vector<char> chunk(64 * 1024);
+
+        for (;;) {
+            // Read request head
+            size_t end;
+            while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+                auto n = recv(s, chunk.data(), int(chunk.size()), 0);
+                if (n <= 0) return;
+                buf.append(chunk.data(), size_t(n));
+            }
+            auto head = buf.substr(0, end + 4);
+            buf.erase(0, end + 4);
+
+            std::string lower(head);
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+            size_t content_len = 0;
+            auto   p = lower.find("\r\ncontent-length:");
+            if (p != std::string::npos)
+                content_len = strtoul(lower.c_str() + p + 17, nullptr, 10);
+            bool close_conn = lower.find("\r\nconnection: close") != std::string::npos;
+
+            if (lower.find("\r\nupgrade: websocket") != std::string::npos) {
+                ServeWebSocket(s, head, lower, buf, chunk);
+                return;
+            }
+
+            // Discard request body
+            while (buf.size() < content_len) {
+                auto n = recv(s, chunk.data(), int(chunk.size()), 0);
+                if (n <= 0) return;
+                buf.append(chunk.data(), size_t(n));
+            }
+            buf.erase(0, content_len);
+
+            auto sp1  = head.find(' ');
+            auto sp2  = head.find(' ', sp1 + 1);
+            auto path = head.substr(sp1 + 1, sp2 - sp1 - 1);
+            bool is_head = head.compare(0, 5, "HEAD ") == 0;
+
+            auto size  = QueryParam(path, "size");
+            auto hdrs  = QueryParam(path, "hdrs");
+            auto delay = QueryParam(path, "delay");
+            ++m_requests;
+
+            // Sleep in steps so that Stop() isn't held up
+            auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+            while (!m_stop && std::chrono::steady_clock::now() < until)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            std::ostringstream out;
+            out << "HTTP/1.1 200 OK\r\n"
+                << "Content-Type: text/plain\r\n"
+                << "Content-Length: " << size << "\r\n";
+            for (size_t i = 0; i < hdrs; ++i)
+                out << "X-Bench-Header-" << i << ": value-" << i << "\r\n";
+            out << "\r\n";
+            auto hs = out.str();
+
+            if (!SendAll(s, hs.c_str(), hs.size()) ||
+                (!is_head && !SendAll(s, Body(size), size)) || close_conn)
+                return;
+        }
+    }
+
+    enum { WS_CONT, WS_TEXT_FRAME, WS_BINARY_FRAME, WS_CLOSE = 8, WS_PING, WS_PONG };
+
+    /// Send an unmasked frame, or a masked one (which a client must reject)
+    static bool SendFrame(sock_t s, int opcode, const std::string& payload, bool masked = false)
+    {
+        std::string f(1, char(0x80 | opcode));
+        auto len = payload.size();
+        auto bit = masked ? 0x80 : 0;
+        if (len < 126)
+            f.push_back(char(bit | int(len)));
+        else if (len < 65536) {
+            f.push_back(char(bit | 126));
+            for (int i = 1; i >= 0; --i) f.push_back(char(len >> (i*8)));
+        } else {
+            f.push_back(char(bit | 127));
+            for (int i = 7; i >= 0; --i) f.push_back(char(uint64_t(len) >> (i*8)));
+        }
+        if (masked)
+            f.append(4, '\0');         // A zero mask leaves the payload as is
+        f += payload;
+        return SendAll(s, f.data(), f.size());
+    }
+
+    /// Read one (masked) client frame. Returns false when the connection is lost
+    static bool RecvFrame(sock_t s, std::string& buf, std::vector<char>& chunk,
+                          int& opcode, std::string& payload)
+    {
+        for (;;) {
+            auto p = reinterpret_cast<const uint8_t*>(buf.data());
+            if (buf.size() >= 2) {
+                uint64_t len = p[1] & 0x7f;
+                size_t   hdr = 2;
+                if (len == 126 && buf.size() >= 4) {
+                    len = uint64_t(p[2]) << 8 | p[3];
+                    hdr = 4;
+                } else if (len == 127 && buf.size() >= 10) {
+                    len = 0;
+                    for (int i = 0; i < 8; ++i) len = len << 8 | p[2+i];
+                    hdr = 10;
+                }
+                bool known = (p[1] & 0x7f) < 126 || hdr > 2;
+                if (known && buf.size() >= hdr + 4 + len) {
+                    opcode = p[0] & 0x0f;
+                    payload.assign(buf, hdr + 4, size_t(len));
+                    for (size_t i = 0; i < payload.size(); ++i)
+                        payload[i] ^= char(p[hdr + (i & 3)]);
+                    buf.erase(0, hdr + 4 + size_t(len));
+                    return true;
+                }
+            }
+            auto n = recv(s, chunk.data(), int(chunk.size()), 0);
+            if (n <= 0) return false;
+            buf.append(chunk.data(), size_t(n));
+        }
+    }
+
+    /// Accept the upgrade and echo text and binary messages. The text "ping"
+    /// makes the server ping the client with "p1" and report the pong as the
+    /// text "pong:p1"; the text "close" makes it close the connection, and
+    /// "masked" makes it send a masked frame. A close from the client is
+    /// answered. Both count in WsCloses()
+    void ServeWebSocket(sock_t s, const std::string& head, const std::string& lower,
+                        std::string& buf, std::vector<char>& chunk)
+    {
+        static const char s_hdr[]  = "\r\nsec-websocket-key:";
+        auto p = lower.find(s_hdr);
+        if (p == std::string::npos) return;
+        p = head.find_first_not_of(' ', p + sizeof(s_hdr) - 1);
+        auto key = head.substr(p, head.find('\r', p) - p);
+
+        auto resp = "HTTP/1.1 101 Switching Protocols\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Accept: " + WsAccept(key) + "\r\n\r\n";
+        if (!SendAll(s, resp.data(), resp.size())) return;
+
+        int         opcode;
+        std::string payload;
+        while (RecvFrame(s, buf, chunk, opcode, payload)) {
+            switch (opcode) {
+                case WS_TEXT_FRAME:
+                    if (payload == "ping") {
+                        if (!SendFrame(s, WS_PING, "p1")) return;
+                        continue;
+                    }
+                    if (payload == "close") {
+                        if (!SendFrame(s, WS_CLOSE, std::string("\x03\xe8", 2))) return;
+                        continue;               // Wait for the client's close
+                    }
+                    if (payload == "masked") {
+                        if (!SendFrame(s, WS_TEXT_FRAME, payload, true)) return;
+                        continue;
+                    }
+                    // fallthrough
+                case WS_BINARY_FRAME:
+                    if (!SendFrame(s, opcode, payload)) return;
+                    break;
+                case WS_PONG:
+                    if (!SendFrame(s, WS_TEXT_FRAME, "pong:" + payload)) return;
+                    break;
+                case WS_CLOSE:
+                    if (payload.size() >= 2)
+                        m_ws_close_code = uint8_t(payload[0]) << 8 | uint8_t(payload[1]);
+                    ++m_ws_closes;
+                    SendFrame(s, WS_CLOSE, payload);
+                    return;
+                default:
+                    break;
+            }
+        }
+    }
+
+    static const char* Body(size_t size)
+    {
+        static std::string s_body;
+        static std::mutex  s_mtx;
+        std::lock_guard<std::mutex> g(s_mtx);
+        if (s_body.size() < size) {
+            static const char s_text[] = "{\"symbol\":\"EURUSD\",\"bid\":1.13456,\"ask\":1.13462},\n";
+            // Reserve upfront so that pointers handed out earlier stay valid
+            s_body.reserve(std::max<size_t>(size, 64 << 20));
+            while (s_body.size() < size)
+                s_body.append(s_text, std::min<size_t>(sizeof(s_text) - 1, size - s_body.size()));
+        }
+        return s_body.data();
+    }
+
+    sock_t                   m_listener;
+    int                      m_port;
+    std::atomic<bool>        m_stop;
+    std::thread              m_thread;
+    std::mutex               m_mtx;
+    std::vector<sock_t>      m_clients;
+    std::vector<std::thread> m_workers;
+    std::atomic<int>         m_requests;
+    std::atomic<int>         m_ws_closes;
+    std::atomic<int>         m_ws_close_code;
+};
+
+//------------------------------------------------------------------------------
+struct Sample
+{
+    std::vector<double> usec;
+
+    void   Add(double v) { usec.push_back(v); }
+    double Pct(double p)
+    {
+        if (usec.empty()) return 0;
+        std::sort(usec.begin(), usec.end());
+        auto i = std::min<size_t>(usec.size() - 1, size_t(p * double(usec.size())));
+        return usec[i];
+    }
+    double Mean() const
+    {
+        double sum = 0;
+        for (auto v : usec) sum += v;
+        return usec.empty() ? 0 : sum / double(usec.size());
+    }
+    std::string Json()
+    {
+        std::ostringstream s;
+        s.precision(1);
+        s << std::fixed
+          << "{\"mean\":" << Mean() << ",\"p50\":" << Pct(0.5) << ",\"p90\":" << Pct(0.9)
+          << ",\"p99\":"  << Pct(0.99) << ",\"max\":" << Pct(1.0) << "}";
+        return s.str();
+    }
+};
+
+struct Case
+{
+    const char* sweep;
+    CurlMethod  method;
+    size_t      body_bytes;
+    int         headers;
+    int         debug;
+};
+
+static const char* MethodName(CurlMethod m)
+{
+    switch (m) {
+        case GET:       return "GET";
+        case POST:      return "POST";
+        case POST_JSON: return "POST_JSON";
+        case POST_FORM: return "POST_FORM";
+        case DEL:       return "DELETE";
+        case PUT:       return "PUT";
+    }
+    return "?";
+}
+
+static double Usec(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - since).count();
+}
+
+static std::string RunCase(int port, const Case& c, int iterations, int warmup, bool& ok)
+{
+    auto curl = CurlInit();
+    ok = curl != nullptr;
+    if (!ok) return std::string();
+
+    std::ostringstream url;
+    url << "http://127.0.0.1:" << port << "/bench?size=" << c.body_bytes << "&hdrs=" << c.headers;
+    CurlSetURL(curl, url.str().c_str());
+    CurlDbgLevel(curl, c.debug);
+
+    if (c.headers) {
+        std::ostringstream hh;
+        for (int i = 0; i < c.headers; ++i)
+            hh << (i ? "\n" : "") << "X-Request-Header-" << i << ": value-" << i;
+        CurlAddHeaders(curl, hh.str().c_str());
+    }
+
+    const char* post = nullptr;
+    if (c.method == POST_JSON)      post = "{\"symbol\":\"EURUSD\",\"volume\":0.1,\"side\":\"buy\"}";
+    else if (c.method == POST_FORM) post = "symbol=EURUSD&volume=0.1&side=buy";
+
+    Sample exec, get, getw;
+    std::vector<char>    buf;
+    std::vector<wchar_t> wbuf;
+    auto   total_start = std::chrono::steady_clock::now();
+    double total_bytes = 0;
+
+    for (int i = 0; i < warmup + iterations; ++i) {
+        if (i == warmup) {
+            total_start = std::chrono::steady_clock::now();
+            total_bytes = 0;
+        }
+        int  code = 0, len = 0;
+        auto t0   = std::chrono::steady_clock::now();
+        auto res  = CurlExecute(curl, &code, &len, c.method, 0, post, 60);
+        auto te   = Usec(t0);
+        if (res != 0 || code != 200) {
+            char err[256];
+            CurlLastError(curl, res, err, sizeof(err));
+            std::cerr << "Request failed (" << res << ", HTTP " << code << "): " << err << std::endl;
+            ok = false;
+            break;
+        }
+
+        wbuf.resize(size_t(len));
+        auto t1 = std::chrono::steady_clock::now();
+        CurlGetDataW(curl, wbuf.data(), len);
+        auto tw = Usec(t1);
+
+        buf.resize(size_t(len));
+        auto t2 = std::chrono::steady_clock::now();
+        CurlGetData(curl, buf.data(), len);
+        auto tg = Usec(t2);
+
+        if (i >= warmup) {
+            exec.Add(te);
+            getw.Add(tw);
+            get.Add(tg);
+            total_bytes += double(len > 0 ? len - 1 : 0);
+        }
+    }
+    auto elapsed = Usec(total_start) / 1e6;
+
+    CurlFinalize(curl);
+
+    std::ostringstream s;
+    s.precision(1);
+    s << std::fixed
+      << "{\"sweep\":\""       << c.sweep             << "\""
+      << ",\"method\":\""      << MethodName(c.method) << "\""
+      << ",\"body_bytes\":"    << c.body_bytes
+      << ",\"headers\":"       << c.headers
+      << ",\"debug\":"         << c.debug
+      << ",\"iterations\":"    << iterations
+      << ",\"ok\":"            << (ok ? "true" : "false")
+      << ",\"execute_us\":"    << exec.Json()
+      << ",\"getdata_us\":"    << get.Json()
+      << ",\"getdataw_us\":"   << getw.Json()
+      << ",\"req_per_sec\":"   << (elapsed > 0 ? double(exec.usec.size()) / elapsed : 0)
+      << ",\"mb_per_sec\":"    << (elapsed > 0 ? total_bytes / elapsed / 1e6 : 0)
+      << "}";
+    return s.str();
+}
+
+//------------------------------------------------------------------------------
+// WebSocket echo round trip
+//------------------------------------------------------------------------------
+/// Wait up to 5s for the next message. Returns CurlWsRecv()'s last result
+static int WsWait(CurlHandle curl, std::string& msg, int& type)
+{
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    std::vector<char> buf(256);
+    for (;;) {
+        auto n = CurlWsRecv(curl, buf.data(), int(buf.size()), &type);
+        if (n >= int(buf.size())) {
+            buf.resize(size_t(n) + 1);
+            continue;
+        }
+        if (n >= 0) {
+            msg.assign(buf.data(), size_t(n));
+            return n;
+        }
+        if (n == -2 || std::chrono::steady_clock::now() > until)
+            return n;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static bool WsCheck(const char* what, bool ok)
+{
+    std::cerr << "ws-echo " << what << (ok ? " ok" : " FAILED") << std::endl;
+    return ok;
+}
+
+static bool WsEcho(CurlHandle curl, const char* what, const std::string& data, CurlWsType type)
+{
+    std::string msg;
+    int         t = 0;
+    bool ok = CurlWsSend(curl, data.data(), int(data.size()), type) == 0 &&
+              WsWait(curl, msg, t) >= 0 && msg == data && t == type;
+    return WsCheck(what, ok);
+}
+
+static bool RunWsEcho(const LoopbackServer& server)
+{
+    std::ostringstream url;
+    url << "ws://127.0.0.1:" << server.Port() << "/ws";
+
+    // The example handshake of RFC 6455 section 1.3
+    if (!WsCheck("accept key", WsAccept("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="))
+        return false;
+
+    auto curl = CurlInit();
+    if (!curl || CurlWsOpen(curl, url.str().c_str()) != 0)
+        return WsCheck("open", false);
+
+    std::string binary("\x00\x01\xfe\xff\x00", 5);
+    std::string large(70000, 'x');
+    for (size_t i = 0; i < large.size(); ++i) large[i] = char('a' + i % 26);
+
+    bool ok = WsEcho(curl, "text",     "hello",  WS_TEXT);
+    ok     &= WsEcho(curl, "binary",   binary,   WS_BINARY);
+    ok     &= WsEcho(curl, "64k+",     large,    WS_TEXT);
+
+    std::string msg;
+    int         type = 0;
+    ok &= WsCheck("ping/pong", CurlWsSend(curl, "ping", -1, WS_TEXT) == 0 &&
+                               WsWait(curl, msg, type) >= 0 && msg == "pong:p1");
+
+    auto closes = server.WsCloses();
+    ok &= WsCheck("server close", CurlWsSend(curl, "close", -1, WS_TEXT) == 0 &&
+                                  WsWait(curl, msg, type) == -2);
+    for (int i = 0; i < 500 && server.WsCloses() == closes; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ok &= WsCheck("close reply", server.WsCloses() == closes + 1);
+    ok &= WsCheck("send after close", CurlWsSend(curl, "late", -1, WS_TEXT) == -2);
+
+    // A second connection closed by the client
+    CurlWsOpen(curl, url.str().c_str());
+    ok &= WsEcho(curl, "reopen", "again", WS_TEXT);
+    CurlWsClose(curl);
+    for (int i = 0; i < 500 && server.WsCloses() == closes + 1; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ok &= WsCheck("client close", server.WsCloses() == closes + 2);
+
+    // A masked frame from the server fails the connection with 1002
+    CurlWsOpen(curl, url.str().c_str());
+    ok &= WsCheck("masked frame", CurlWsSend(curl, "masked", -1, WS_TEXT) == 0 &&
+                                  WsWait(curl, msg, type) == -2);
+    for (int i = 0; i < 500 && server.WsCloses() == closes + 2; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ok &= WsCheck("protocol error", server.WsCloseCode() == 1002);
+
+    CurlFinalize(curl);
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+// Concurrent use of the API from several threads
+//------------------------------------------------------------------------------
+static const int STRESS_THREADS = 8;
+
+/// Run `fn(i)` on STRESS_THREADS threads released at the same time
+template <typename Fn>
+static void RunThreads(Fn fn)
+{
+    std::atomic<int>         ready(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < STRESS_THREADS; ++i)
+        threads.emplace_back([&, i] {
+            ++ready;
+            while (ready.load() < STRESS_THREADS) std::this_thread::yield();
+            fn(i);
+        });
+    for (auto& t : threads) t.join();
+}
+
+/// Poll `CurlAsyncResult()` until the request completes (at most 10s)
+static int AsyncWait(CurlHandle curl, int& code, int& len)
+{
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    int  rc;
+    while ((rc = CurlAsyncResult(curl, &code, &len)) == ERR_PENDING &&
+           std::chrono::steady_clock::now() < until)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return rc;
+}
+
+static bool StressCheck(const char* what, bool ok)
+{
+    std::cerr << "stress " << what << (ok ? " ok" : " FAILED") << std::endl;
+    return ok;
+}
+
+static bool RunStress(const LoopbackServer& server, int iterations)
+{
+    using namespace std::chrono;
+
+    std::ostringstream base;
+    base << "http://127.0.0.1:" << server.Port();
+    auto url = base.str() + "/stress?size=1000&hdrs=10";
+
+    // Threads sharing a handle: each request must succeed, though the
+    // response read may be another thread's. `len` counts the trailing '\0'
+    auto shared = CurlInit();
+    CurlSetURL(shared, url.c_str());
+    std::atomic<int> failed(0);
+    RunThreads([&](int) {
+        std::vector<char> buf(4096);
+        for (int n = 0; n < iterations; ++n) {
+            int code = 0, len = 0;
+            if (CurlExecute(shared, &code, &len) != 0 || code != 200 || len != 1001)
+                ++failed;
+            CurlGetData(shared, buf.data(), int(buf.size()));
+            for (int h = 0, k = int(CurlTotRespHeaders(shared)); h < k; ++h)
+                CurlGetRespHeader(shared, h, buf.data(), int(buf.size()));
+        }
+    });
+    bool ok = StressCheck("shared handle", !failed);
+
+    // A request blocking one thread is cancelled from another
+    auto slow = base.str() + "/stress?size=10&delay=5000";
+    CurlSetURL(shared, slow.c_str());
+    int  rc    = 0;
+    auto begin = steady_clock::now();
+    std::thread blocked([&] { int code, len; rc = CurlExecute(shared, &code, &len); });
+    std::this_thread::sleep_for(milliseconds(200));
+    CurlCancel(shared);
+    blocked.join();
+    ok &= StressCheck("cancel", rc == CURLE_ABORTED_BY_CALLBACK &&
+                                steady_clock::now() - begin < seconds(3));
+    CurlFinalize(shared);
+
+    // Asynchronous requests of a handle per thread, every other one of them
+    // cancelled by the next thread
+    std::vector<CurlHandle> handles(STRESS_THREADS);
+    for (auto& h : handles) {
+        h = CurlInit();
+        CurlSetURL(h, url.c_str());
+    }
+    failed = 0;
+    RunThreads([&](int i) {
+        for (int n = 0; n < iterations / 4; ++n) {
+            int code = 0, len = 0;
+            if (CurlExecuteAsync(handles[i]) != 0 || AsyncWait(handles[i], code, len) != 0 ||
+                code != 200 || len != 1001)
+                ++failed;
+        }
+    });
+    ok &= StressCheck("async", !failed);
+
+    for (auto h : handles)
+        CurlSetURL(h, slow.c_str());
+    failed = 0;
+    RunThreads([&](int i) {
+        int code = 0, len = 0;
+        if (i % 2) {
+            std::this_thread::sleep_for(milliseconds(200));
+            CurlCancel(handles[i - 1]);
+        } else if (CurlExecuteAsync(handles[i]) != 0 ||
+                   AsyncWait(handles[i], code, len) != CURLE_ABORTED_BY_CALLBACK)
+            ++failed;
+    });
+    ok &= StressCheck("async cancel", !failed);
+
+    // Identical requests of all threads, synchronous and asynchronous, are
+    // sent once
+    auto same = base.str() + "/stress?size=100&delay=500";
+    for (auto h : handles) {
+        CurlSetURL(h, same.c_str());
+        CurlSetCoalesce(h, 1);
+    }
+    failed    = 0;
+    auto sent = server.Requests();
+    RunThreads([&](int i) {
+        int code = 0, len = 0;
+        auto rc  = i % 2 ? CurlExecute(handles[i], &code, &len)
+                 : CurlExecuteAsync(handles[i]) ? -1 : AsyncWait(handles[i], code, len);
+        if (rc != 0 || code != 200 || len != 101)
+            ++failed;
+    });
+    ok &= StressCheck("coalesce", !failed && server.Requests() == sent + 1);
+
+    // Cancelling the request the others wait for doesn't fail them: one of
+    // them is sent instead
+    failed = 0;
+    RunThreads([&](int i) {
+        int code = 0, len = 0;
+        if (i == 0) {
+            if (CurlExecute(handles[0], &code, &len) != CURLE_ABORTED_BY_CALLBACK)
+                ++failed;
+            return;
+        }
+        std::this_thread::sleep_for(milliseconds(100));
+        if (i == 1) {
+            std::this_thread::sleep_for(milliseconds(100));
+            CurlCancel(handles[0]);
+            return;
+        }
+        auto rc = i % 2 ? CurlExecute(handles[i], &code, &len)
+                : CurlExecuteAsync(handles[i]) ? -1 : AsyncWait(handles[i], code, len);
+        if (rc != 0 || code != 200 || len != 101)
+            ++failed;
+    });
+    ok &= StressCheck("coalesce cancel", !failed);
+
+    for (auto h : handles)
+        CurlFinalize(h);
+    return ok;
+}
+
+static int Iterations(size_t bytes, int base)
+{
+    if (bytes >= 10000000) return std::max<int>(3,  base / 50);
+    if (bytes >= 1000000)  return std::max<int>(10, base / 10);
+    return base;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string out_file = "bench_output.json";
+    int         base     = 200;
+    bool        quick    = false;
+    bool        ws_echo  = false;
+    bool        stress   = false;
+
+    for (auto i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [-h|--help] [-o OutFile.json] [-n Iterations] [--quick] [--ws-echo] [--stress]"
+                      << std::endl;
+            return 1;
+        }
+        if (!strcmp(argv[i], "-o") && i < argc - 1)
+            out_file = argv[++i];
+        else if (!strcmp(argv[i], "-n") && i < argc - 1)
+            base = std::max<int>(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--quick"))
+            quick = true;
+        else if (!strcmp(argv[i], "--ws-echo"))
+            ws_echo = true;
+        else if (!strcmp(argv[i], "--stress"))
+            stress = true;
+        else {
+            std::cerr << "Invalid argument: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (quick) base = std::min<int>(base, 20);
+
+    // Keep diagnostic output off the terminal; it doesn't affect the request path
+    CurlSetLogSink(LOG_SINK_NONE);
+
+    LoopbackServer server;
+    if (!server.Start()) {
+        std::cerr << "Cannot start loopback server!" << std::endl;
+        return 2;
+    }
+
+    if (ws_echo) {
+        auto ok = RunWsEcho(server);
+        server.Stop();
+        return ok ? 0 : 3;
+    }
+
+    if (stress) {
+        auto ok = RunStress(server, std::min<int>(base, 50));
+        server.Stop();
+        return ok ? 0 : 3;
+    }
+
+    std::vector<Case> cases;
+    std::vector<size_t> sizes = {100, 1000, 10000, 100000, 1000000, 10000000, 50000000};
+    if (quick) sizes.resize(5);
+
+    for (auto sz : sizes)             cases.push_back({"body_size", GET, sz, 0, 0});
+    for (int  h  : {0, 10, 50, 200})  cases.push_back({"headers",   GET, 1000, h, 0});
+    for (auto m  : {GET, POST_JSON, POST_FORM, DEL})
+                                      cases.push_back({"method",    m, 1000, 0, 0});
+    for (int  d  : {0, 1, 2, 3})      cases.push_back({"debug",     GET, 10000, 0, d});
+
+    std::ostringstream json;
+    json << "{\"benchmark\":\"curl-mt4-bench\",\"libcurl\":\"" << curl_version_info(CURLVERSION_NOW)->version
+         << "\",\"cases\":[\n";
+
+    bool all_ok = true;
+    for (size_t i = 0; i < cases.size(); ++i) {
+        auto& c = cases[i];
+        bool  ok;
+        auto  n = Iterations(c.body_bytes, base);
+        auto  r = RunCase(server.Port(), c, n, std::min<int>(n, 5), ok);
+        all_ok &= ok;
+        std::cerr << c.sweep << " " << MethodName(c.method) << " body=" << c.body_bytes
+                  << " hdrs=" << c.headers << " dbg=" << c.debug << (ok ? " ok" : " FAILED") << std::endl;
+        json << "  " << r << (i + 1 < cases.size() ? ",\n" : "\n");
+    }
+    json << "]}\n";
+
+    server.Stop();
+
+    std::ofstream f(out_file);
+    f << json.str();
+    std::cerr << "Results written to " << out_file << std::endl;
+
+    return all_ok ? 0 : 3;
+}
@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-breaker.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Process-wide per-host circuit breakers
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+//------------------------------------------------------------------------------
+/// Circuit breaker of a host. After `threshold` consecutive failures
+/// (transport errors or 5xx responses) the breaker opens and requests to the
+/// host fail immediately for `cooldown_ms`. It's then half-open: up to
+/// `probes` requests are let through, and the first one to succeed closes
+/// the breaker while a failure opens it for another cool-down. Probes that
+/// never report back (e.g. cancelled) are written off after a cool-down.
+/// A `threshold` of 0 disables the breaker.
+//------------------------------------------------------------------------------
+class CircuitBreaker
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum State { CLOSED, OPEN, HALF_OPEN };
+
+    struct Config {
+        int  threshold;
+        long cooldown_ms;
+        int  probes;
+    };
+
+    explicit CircuitBreaker(const Config& cfg)
+        : m_cfg(cfg), m_own_cfg(false), m_state(CLOSED), m_failures(0), m_probes(0)
+    {}
+
+    /// Set the configuration. A host's own configuration isn't replaced by
+    /// the default one
+    void Configure(const Config& cfg, bool own)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!own && m_own_cfg) return;
+        m_cfg     = cfg;
+        m_own_cfg = own;
+        if (!m_cfg.threshold) Close();
+    }
+
+    /// Check whether a request may be sent. A request let through must
+    /// report its outcome with `Record()`
+    bool Allow()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!m_cfg.threshold || m_state == CLOSED)
+            return true;
+        auto now = Clock::now();
+        if (m_state == OPEN) {
+            if (now < m_until) return false;
+            m_state  = HALF_OPEN;
+            m_probes = 0;
+        }
+        if (m_probes >= m_cfg.probes) {
+            if (now < m_until) return false;
+            m_probes = 0;               // Outstanding probes are lost
+        }
+        ++m_probes;
+        m_until = now + std::chrono::milliseconds(m_cfg.cooldown_ms);
+        return true;
+    }
+
+    void Record(bool failure)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!m_cfg.threshold)
+            return;
+        if (!failure)
+            Close();
+        else if (m_state != CLOSED || ++m_failures >= m_cfg.threshold) {
+            m_state    = OPEN;
+            m_until    = Clock::now() + std::chrono::milliseconds(m_cfg.cooldown_ms);
+            m_failures = 0;
+        }
+    }
+
+    State GetState()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_state == OPEN && Clock::now() >= m_until ? HALF_OPEN : m_state;
+    }
+
+    /// Outcome of a request that counts against the breaker
+    static bool Failure(int res, long status) { return res != 0 || status >= 500; }
+
+private:
+    void Close()
+    {
+        m_state    = CLOSED;
+        m_failures = 0;
+        m_probes   = 0;
+    }
+
+    std::mutex          m_mtx;
+    Config              m_cfg;
+    bool                m_own_cfg;  ///< Configured for this host
+    State               m_state;
+    int                 m_failures; ///< Consecutive failures while closed
+    int                 m_probes;   ///< Requests let through while half-open
+    Clock::time_point   m_until;    ///< End of the cool-down (or of a probe)
+};
+
+//------------------------------------------------------------------------------
+/// Registry of circuit breakers keyed by host. Breakers are never deleted,
+/// so the pointers handed out by `Get()` may be cached by the caller for the
+/// lifetime of the process. Breakers are disabled until configured.
+//------------------------------------------------------------------------------
+class CircuitBreakers
+{
+public:
+    static CircuitBreakers& Instance()
+    {
+        static CircuitBreakers s_instance;
+        return s_instance;
+    }
+
+    CircuitBreaker* Get(const std::string& host)
+    {
+        if (host.empty()) return nullptr;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return Find(host);
+    }
+
+    /// Configure the breaker of `host`, or the default of all hosts not
+    /// configured individually if `host` is empty
+    void Configure(const std::string& host, const CircuitBreaker::Config& cfg)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!host.empty()) {
+            Find(host)->Configure(cfg, true);
+            return;
+        }
+        m_default = cfg;
+        for (auto& kv : m_breakers)
+            kv.second->Configure(cfg, false);
+    }
+
+private:
+    CircuitBreakers() : m_default{0, 30000, 1} {}
+
+    CircuitBreaker* Find(const std::string& host)
+    {
+        auto& b = m_breakers[host];
+        if (!b) b.reset(new CircuitBreaker(m_default));
+        return b.get();
+    }
+
+    std::mutex                                              m_mtx;
+    CircuitBreaker::Config                                  m_default;
+    std::map<std::string, std::unique_ptr<CircuitBreaker>>  m_breakers;
+};
@@ -0,0 +1,498 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-engine.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Background transfer engine driving a `curl_multi` handle
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <curl/curl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+/// Runs long-lived and asynchronous transfers (`Job`s) on a background thread
+/// so that MQL code never blocks on them. A job configures its own easy
+/// handle in `Start()`, and when the transfer completes `Done()` decides
+/// whether it should be started again after a delay (e.g. to reconnect).
+/// A job using `CURLOPT_CONNECT_ONLY` can instead keep the connection open:
+/// the engine then polls its socket along with the multi handle and calls
+/// `Poll()` when it's ready or when the job's own timeout expires.
+/// Transfers of a job that names a `SlotHost()` take one of the connection
+/// slots of that host, if limited (see `Configure()`). Jobs waiting for a
+/// slot start in order of `Priority()`, and one slot per host is reserved
+/// for CRITICAL jobs. While a CRITICAL transfer is in progress, BULK ones
+/// are throttled.
+/// All `Job` methods are called on the engine thread. Other threads interact
+/// with the engine through `Submit()`, `Cancel()`, `Wake()` and `Post()`,
+/// which queue a command and wake up the engine.
+//------------------------------------------------------------------------------
+class Engine
+{
+public:
+    class Job
+    {
+    public:
+        /// Returned by `Done()` to keep a connect-only connection open
+        static const long KEEP_OPEN = -2;
+
+        /// Scheduling classes, in order of precedence
+        enum Class { CRITICAL, NORMAL, BULK };
+
+        virtual ~Job() {}
+        /// Return a configured easy handle to perform, or nullptr to finish
+        virtual CURL* Start() = 0;
+        /// The transfer completed with `res`. Return a delay in ms after
+        /// which to `Start()` the job again, -1 to finish, or KEEP_OPEN
+        virtual long  Done(CURLcode res) = 0;
+        /// The job finished or was cancelled, and won't be started again
+        virtual void  Finished() {}
+
+        /// Open connection: socket to wait on and whether to wait until it's
+        /// writable (rather than readable)
+        virtual curl_socket_t Socket() { return CURL_SOCKET_BAD; }
+        virtual bool          Writing() { return false; }
+        /// Open connection: the socket is ready (`events` are CURL_WAIT_POLL*
+        /// flags), the job was woken up or its timeout expired. Return the
+        /// timeout in ms until the next call, or -1 to finish
+        virtual long          Poll(int /*events*/) { return -1; }
+
+        /// Scheduling class of the job's transfers
+        virtual int                Priority() const { return NORMAL; }
+        /// Host whose connection slots the job's transfers take, or ""
+        virtual const std::string& SlotHost() const { static const std::string s_none; return s_none; }
+    };
+
+    using JobPtr = std::shared_ptr<Job>;
+
+    static Engine& Instance()
+    {
+        static Engine s_instance;
+        return s_instance;
+    }
+
+    ~Engine() { Stop(); }
+
+    /// Start `job` on the engine thread after `delay_ms`
+    void Submit(const JobPtr& job, long delay_ms = 0)
+    {
+        Post([this, job, delay_ms] { Schedule(job, delay_ms); });
+    }
+
+    /// Stop `job`, aborting its transfer if one is in progress
+    void Cancel(const JobPtr& job)
+    {
+        Post([this, job] { Finish(job); });
+    }
+
+    /// `Poll()` the open connection of `job` as soon as possible
+    void Wake(const JobPtr& job)
+    {
+        Post([this, job] {
+            auto it = m_jobs.find(job.get());
+            if (it != m_jobs.end() && it->second.open)
+                it->second.deadline = Clock::now();
+        });
+    }
+
+    /// Allow up to `host_slots` transfers per host (0 - unlimited) and limit
+    /// BULK transfers to `bulk_bps` bytes/s while a CRITICAL one is in
+    /// progress (0 - don't throttle)
+    void Configure(int host_slots, long bulk_bps)
+    {
+        Post([this, host_slots, bulk_bps] {
+            m_host_slots = host_slots;
+            m_bulk_bps   = bulk_bps;
+            Throttle(m_critical > 0);
+            m_dispatch   = true;
+        });
+    }
+
+    /// Engine thread only (from a `Job` method): start `job` after
+    /// `delay_ms`, restarting it if active, without waiting for the next loop
+    void Reschedule(const JobPtr& job, long delay_ms) { Schedule(job, delay_ms); }
+    /// Engine thread only: stop `job` at once, like `Cancel()`
+    void Abort(const JobPtr& job)                      { Finish(job); }
+
+    /// Run `f` on the engine thread
+    void Post(std::function<void()>&& f)
+    {
+        {
+            std::lock_guard<std::mutex> g(m_cmd_mtx);
+            m_cmds.emplace_back(std::move(f));
+        }
+        EnsureStarted();
+        Wakeup();
+    }
+
+    /// Number of jobs with a transfer in progress (engine thread only)
+    size_t Active() const { return m_active.size(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Engine()
+        : m_multi(curl_multi_init())
+        , m_host_slots(0)
+        , m_bulk_bps(0)
+        , m_critical(0)
+        , m_seq(0)
+        , m_dispatch(false)
+        , m_started(false)
+        , m_stop(false)
+        , m_done(false)
+    {}
+
+    void EnsureStarted()
+    {
+        if (m_started.load(std::memory_order_acquire)) return;
+        std::lock_guard<std::mutex> g(m_thread_mtx);
+        if (m_started.load(std::memory_order_relaxed)) return;
+        m_thread = std::thread([this] { Run(); });
+        m_started.store(true, std::memory_order_release);
+    }
+
+    /// Don't join(): when the DLL is unloaded this runs under the loader lock,
+    /// which the exiting thread would need. Wait until it's done with our code
+    void Stop()
+    {
+        std::lock_guard<std::mutex> g(m_thread_mtx);
+        if (m_started.load()) {
+            m_stop.store(true);
+            Wakeup();
+            for (int i = 0; i < 200 && !m_done.load(); ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            m_thread.detach();
+            m_started.store(false);
+            if (!m_done.load())
+                return;     // Leak the multi handle rather than pull it from under the thread
+        }
+        if (m_multi) curl_multi_cleanup(m_multi);
+        m_multi = nullptr;
+    }
+
+    void Wakeup()
+    {
+#if LIBCURL_VERSION_NUM >= 0x074400     // 7.68.0
+        if (m_multi) curl_multi_wakeup(m_multi);
+#endif
+    }
+
+    void Run()
+    {
+        std::vector<std::function<void()>> cmds;
+
+        while (!m_stop.load(std::memory_order_relaxed)) {
+            {
+                std::lock_guard<std::mutex> g(m_cmd_mtx);
+                cmds.swap(m_cmds);
+            }
+            for (auto& f : cmds) f();
+            cmds.clear();
+
+            RunTimers();
+
+            int running;
+            curl_multi_perform(m_multi, &running);
+
+            CURLMsg* msg;
+            int      left;
+            while ((msg = curl_multi_info_read(m_multi, &left)))
+                if (msg->msg == CURLMSG_DONE)
+                    Completed(msg->easy_handle, msg->data.result);
+            if (m_dispatch)
+                Dispatch();
+
+            PollOpen();
+            Wait();
+        }
+
+        // Abort transfers in progress and drop pending restarts
+        while (!m_active.empty())
+            Finish(m_active.begin()->second);
+        while (!m_timers.empty())
+            Finish(m_timers.begin()->second);
+        while (!m_queued.empty())
+            Finish(m_queued.begin()->second);
+        m_done.store(true);
+    }
+
+    /// Wait for socket activity, the next timer or a wakeup
+    void Wait()
+    {
+        long timeout = 1000;
+        curl_multi_timeout(m_multi, &timeout);
+        if (timeout < 0 || timeout > 1000) timeout = 1000;
+        auto now   = Clock::now();
+        auto until = [&timeout, now](Clock::time_point t) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - now).count();
+            timeout = std::max<long>(0, std::min<long>(timeout, long(ms)));
+        };
+        if (!m_timers.empty())
+            until(m_timers.begin()->first);
+
+        // Sockets of open connections
+        m_fds.clear();
+        m_fd_jobs.clear();
+        for (auto& j : m_jobs)
+            if (j.second.open) {
+                until(j.second.deadline);
+                auto job = m_active[j.second.easy];
+                auto fd  = job->Socket();
+                if (fd == CURL_SOCKET_BAD) continue;
+                curl_waitfd w;
+                w.fd      = fd;
+                w.events  = job->Writing() ? CURL_WAIT_POLLOUT : CURL_WAIT_POLLIN;
+                w.revents = 0;
+                m_fds.push_back(w);
+                m_fd_jobs.push_back(j.first);
+            }
+        auto fds = m_fds.empty() ? nullptr : &m_fds[0];
+        auto n   = unsigned(m_fds.size());
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_poll(m_multi, fds, n, int(timeout), nullptr);
+#else
+        // No wakeup support: bound the latency of commands posted by callers
+        curl_multi_wait(m_multi, fds, n, int(std::min<long>(timeout, 10)), nullptr);
+#endif
+        for (size_t i = 0; i < m_fds.size(); ++i) {
+            if (!m_fds[i].revents) continue;
+            auto it = m_jobs.find(m_fd_jobs[i]);
+            if (it == m_jobs.end()) continue;
+            it->second.events   = m_fds[i].revents;
+            it->second.deadline = now;
+        }
+    }
+
+    /// Poll open connections that are ready or whose timeout expired
+    void PollOpen()
+    {
+        auto now = Clock::now();
+        std::vector<JobPtr> done;
+        for (auto& j : m_jobs) {
+            auto& e = j.second;
+            if (!e.open || e.deadline > now) continue;
+            auto job = m_active[e.easy];
+            auto ms  = job->Poll(e.events);
+            e.events = 0;
+            if (ms < 0)
+                done.push_back(job);
+            else
+                e.deadline = Clock::now() + std::chrono::milliseconds(ms);
+        }
+        for (auto& job : done)
+            Finish(job);
+    }
+
+    void Schedule(const JobPtr& job, long delay_ms)
+    {
+        if (m_jobs.count(job.get()))
+            Remove(job);                // Already active or pending: restart
+        if (delay_ms <= 0)
+            Start(job);
+        else {
+            auto it = m_timers.emplace(Clock::now() + std::chrono::milliseconds(delay_ms), job);
+            m_jobs[job.get()] = Entry(nullptr, it);
+        }
+    }
+
+    void RunTimers()
+    {
+        auto now = Clock::now();
+        while (!m_timers.empty() && m_timers.begin()->first <= now) {
+            auto job = m_timers.begin()->second;
+            m_timers.erase(m_timers.begin());
+            m_jobs.erase(job.get());
+            Start(job);
+        }
+    }
+
+    void Start(const JobPtr& job)
+    {
+        auto limited = m_host_slots > 0 && !job->SlotHost().empty();
+        if (limited && !Admit(*job)) {
+            Entry e;
+            e.queued = true;
+            e.slot   = m_queued.emplace(std::make_pair(job->Priority(), m_seq++), job).first;
+            m_jobs[job.get()] = e;
+            return;
+        }
+        auto easy = job->Start();
+        if (!easy) {
+            job->Finished();
+            return;
+        }
+        auto& e   = m_jobs[job.get()] = Entry(easy, m_timers.end());
+        m_active[easy] = job;
+        if (limited) {
+            auto& slots = m_host_active[job->SlotHost()];
+            ++slots.used;
+            if (job->Priority() == Job::CRITICAL) ++slots.critical;
+            e.slot_taken = true;
+        }
+        if (job->Priority() == Job::CRITICAL && !m_critical++)
+            Throttle(true);
+        else if (job->Priority() == Job::BULK && m_critical)
+            Limit(easy, m_bulk_bps);
+        curl_multi_add_handle(m_multi, easy);
+    }
+
+    /// Check that a connection slot of the job's host is free for it. With
+    /// two or more slots, other than CRITICAL jobs can't take the last one
+    bool Admit(const Job& job) const
+    {
+        auto it = m_host_active.find(job.SlotHost());
+        if (it == m_host_active.end())
+            return true;
+        auto& slots = it->second;
+        return slots.used < m_host_slots &&
+               (job.Priority() == Job::CRITICAL || m_host_slots < 2 ||
+                slots.used - slots.critical < m_host_slots - 1);
+    }
+
+    /// Start the jobs waiting for a connection slot that became free
+    void Dispatch()
+    {
+        m_dispatch = false;
+        for (auto it = m_queued.begin(); it != m_queued.end(); ) {
+            if (m_host_slots > 0 && !Admit(*it->second)) {
+                ++it;
+                continue;
+            }
+            auto job = it->second;
+            m_queued.erase(it);
+            m_jobs.erase(job.get());
+            Start(job);
+            it = m_queued.begin();      // Start() may have changed the queue
+        }
+    }
+
+    /// Throttle BULK transfers in progress, or lift the limit
+    void Throttle(bool on)
+    {
+        for (auto& a : m_active)
+            if (a.second->Priority() == Job::BULK)
+                Limit(a.first, on ? m_bulk_bps : 0);
+    }
+
+    static void Limit(CURL* easy, long bps)
+    {
+        curl_easy_setopt(easy, CURLOPT_MAX_RECV_SPEED_LARGE, curl_off_t(bps));
+        curl_easy_setopt(easy, CURLOPT_MAX_SEND_SPEED_LARGE, curl_off_t(bps));
+    }
+
+    void Completed(CURL* easy, CURLcode res)
+    {
+        auto it = m_active.find(easy);
+        if (it == m_active.end()) {
+            curl_multi_remove_handle(m_multi, easy);
+            return;
+        }
+        auto job   = it->second;
+        auto delay = job->Done(res);
+        if (delay == Job::KEEP_OPEN) {
+            // Removing a connect-only handle from the multi would close it
+            auto& e    = m_jobs[job.get()];
+            e.open     = true;
+            e.deadline = Clock::now();
+            return;
+        }
+        Remove(job);
+        if (delay < 0)
+            job->Finished();
+        else
+            Schedule(job, delay);
+    }
+
+    void Finish(JobPtr job)
+    {
+        if (!m_jobs.count(job.get()))
+            return;
+        Remove(job);
+        job->Finished();
+    }
+
+    /// Detach `job` from the multi handle or from the timer queue
+    void Remove(const JobPtr& job)
+    {
+        auto it = m_jobs.find(job.get());
+        if (it == m_jobs.end()) return;
+        auto& e = it->second;
+        if (e.easy) {
+            curl_multi_remove_handle(m_multi, e.easy);
+            m_active.erase(e.easy);
+            if (e.slot_taken) {
+                auto h = m_host_active.find(job->SlotHost());
+                if (job->Priority() == Job::CRITICAL) --h->second.critical;
+                if (!--h->second.used) m_host_active.erase(h);
+                m_dispatch = true;
+            }
+            if (job->Priority() == Job::CRITICAL && !--m_critical)
+                Throttle(false);
+        } else if (e.queued)
+            m_queued.erase(e.slot);
+        else
+            m_timers.erase(e.timer);
+        m_jobs.erase(it);
+    }
+
+    using Timers = std::multimap<Clock::time_point, JobPtr>;
+    /// Connection slots of a host taken by transfers in progress
+    struct Slots {
+        Slots() : used(0), critical(0) {}
+        int used;
+        int critical;
+    };
+    /// Jobs waiting for a connection slot by priority and order of arrival
+    using Queue  = std::map<std::pair<int, uint64_t>, JobPtr>;
+
+    struct Entry {
+        Entry(CURL* e = nullptr, Timers::iterator t = Timers::iterator())
+            : easy(e), timer(t), queued(false), slot_taken(false), open(false), events(0) {}
+
+        CURL*             easy;     ///< Transfer in progress or open connection, or
+        Timers::iterator  timer;    ///< pending (re)start, or
+        Queue::iterator   slot;     ///< waiting for a connection slot if `queued`
+        bool              queued;
+        bool              slot_taken;   ///< The transfer takes a slot of its host
+        bool              open;     ///< `Done()` returned KEEP_OPEN
+        int               events;   ///< Socket events since the last `Poll()`
+        Clock::time_point deadline; ///< Next `Poll()` of an open connection
+    };
+
+    CURLM*                              m_multi;
+
+    std::mutex                          m_cmd_mtx;
+    std::vector<std::function<void()>>  m_cmds;
+
+    // Only touched by the engine thread
+    std::unordered_map<CURL*, JobPtr>   m_active;
+    std::unordered_map<Job*, Entry>     m_jobs;
+    Timers                              m_timers;
+    Queue                               m_queued;
+    std::unordered_map<std::string, Slots> m_host_active;
+    int                                 m_host_slots;
+    long                                m_bulk_bps;
+    int                                 m_critical;     ///< CRITICAL transfers in progress
+    uint64_t                            m_seq;
+    bool                                m_dispatch;     ///< A slot was freed
+    std::vector<curl_waitfd>            m_fds;
+    std::vector<Job*>                   m_fd_jobs;
+
+    std::mutex                          m_thread_mtx;
+    std::thread                         m_thread;
+    std::atomic<bool>                   m_started;
+    std::atomic<bool>                   m_stop;
+    std::atomic<bool>                   m_done;
+};
@@ -0,0 +1,153 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-flight.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Process-wide coalescing of identical requests in flight
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//------------------------------------------------------------------------------
+/// A transfer whose response is shared by all requests that joined it.
+/// The leader (the request performing the transfer) lands it with the
+/// response, which is read-only from then on. A leader giving up before a
+/// transfer completes (cancelled, past its deadline, rate limited) abandons
+/// the flight instead: its followers then make the request themselves.
+//------------------------------------------------------------------------------
+class Flight
+{
+public:
+    struct Response {
+        int                      res;
+        long                     status;
+        std::string              body;
+        std::vector<std::string> headers;
+        std::string              err;
+    };
+
+    Flight() : m_done(false), m_abandoned(false) {}
+
+    void Land(Response&& r)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_resp = std::move(r);
+            m_done.store(true, std::memory_order_release);
+        }
+        m_cv.notify_all();
+    }
+
+    /// Land the flight without a response
+    void Abandon()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_abandoned = true;
+            m_done.store(true, std::memory_order_release);
+        }
+        m_cv.notify_all();
+    }
+
+    bool Done()      const { return m_done.load(std::memory_order_acquire); }
+    /// Done without a response, which the followers must get themselves
+    bool Abandoned() const { return Done() && m_abandoned; }
+
+    /// Wait for the flight to be done until `deadline`. Returns false on timeout
+    template <class TimePoint>
+    bool Wait(const TimePoint& deadline)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        return m_cv.wait_until(lock, deadline, [this] { return Done(); });
+    }
+
+    /// The response, once `Done()` and not `Abandoned()`
+    const Response& Get() const { return m_resp; }
+
+private:
+    std::mutex              m_mtx;
+    std::condition_variable m_cv;
+    std::atomic<bool>       m_done;
+    bool                    m_abandoned;
+    Response                m_resp;
+};
+
+//------------------------------------------------------------------------------
+/// Registry of flights keyed by request. A request identical to one in
+/// flight joins it instead of opening another connection, and receives the
+/// same response bytes. A flight is removed when it lands, so a later
+/// request starts a new transfer: only requests that overlap are coalesced.
+//------------------------------------------------------------------------------
+class SingleFlight
+{
+public:
+    using FlightPtr = std::shared_ptr<Flight>;
+
+    static SingleFlight& Instance()
+    {
+        static SingleFlight s_instance;
+        return s_instance;
+    }
+
+    /// Key of a GET request: the URL, the options affecting the response
+    /// and the request headers (in any order)
+    static std::string Key(const std::string& url, unsigned opts, std::vector<std::string> headers)
+    {
+        std::sort(headers.begin(), headers.end());
+        auto key = std::to_string(opts);
+        key += ' ';
+        key += url;
+        for (auto& h : headers)
+            if (!h.empty()) { key += '\n'; key += h; }
+        return key;
+    }
+
+    /// Join the flight of `key`, or start one if there's none, in which case
+    /// `leader` is set and the caller must `Land()` it
+    FlightPtr Join(const std::string& key, bool& leader)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto& f = m_flights[key];
+        leader  = !f;
+        if (leader) f = std::make_shared<Flight>();
+        return f;
+    }
+
+    /// Land the flight of `key` led by the caller, waking up its followers
+    void Land(const std::string& key, const FlightPtr& flight, Flight::Response&& r)
+    {
+        Remove(key, flight);
+        flight->Land(std::move(r));
+    }
+
+    /// Abandon the flight of `key` led by the caller, so that its followers
+    /// join a new flight (or lead it) with the request
+    void Abandon(const std::string& key, const FlightPtr& flight)
+    {
+        Remove(key, flight);
+        flight->Abandon();
+    }
+
+private:
+    SingleFlight() = default;
+
+    void Remove(const std::string& key, const FlightPtr& flight)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto it = m_flights.find(key);
+        if (it != m_flights.end() && it->second == flight)
+            m_flights.erase(it);
+    }
+
+    std::mutex                                  m_mtx;
+    std::unordered_map<std::string, FlightPtr>  m_flights;
+};
@@ -0,0 +1,174 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-limit.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Process-wide client-side rate limits per host and endpoint prefix
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "curl-mt4-stats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+/// Token bucket holding up to `burst` tokens, refilled at `rate` tokens per
+/// second. A request takes a token even if there's none left, so the level
+/// goes negative by the number of requests queued behind the bucket, and
+/// each one waits until the refill covers its token.
+//------------------------------------------------------------------------------
+class TokenBucket
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket(double rate, double burst, long max_delay_ms)
+        : m_rate(rate), m_burst(burst), m_max_delay(max_delay_ms)
+        , m_tokens(burst), m_last(Clock::now())
+    {}
+
+    void Configure(double rate, double burst, long max_delay_ms)
+    {
+        Refill(Clock::now());
+        m_rate      = rate;
+        m_burst     = burst;
+        m_max_delay = max_delay_ms;
+        m_tokens    = std::min<double>(m_tokens, burst);
+    }
+
+    /// Tokens available (negative - requests queued)
+    double Level(Clock::time_point now) { Refill(now); return m_tokens; }
+    long   MaxDelay() const             { return m_max_delay; }
+
+    /// Delay in ms before a request taking a token now may be sent. A
+    /// `critical` request isn't queued behind others: it waits for one
+    /// token at most, and the one it takes delays those queued after it
+    long Wait(Clock::time_point now, bool critical = false)
+    {
+        Refill(now);
+        auto level = critical ? std::max<double>(m_tokens, 0) : m_tokens;
+        return level >= 1 ? 0 : long(std::ceil((1 - level) * 1000 / m_rate));
+    }
+
+    void Take() { m_tokens -= 1; }
+
+private:
+    void Refill(Clock::time_point now)
+    {
+        auto secs = std::chrono::duration<double>(now - m_last).count();
+        m_tokens  = std::min<double>(m_burst, m_tokens + secs * m_rate);
+        m_last    = now;
+    }
+
+    double              m_rate;
+    double              m_burst;
+    long                m_max_delay;    ///< Longest a request may be queued
+    double              m_tokens;
+    Clock::time_point   m_last;         ///< Time of the last refill
+};
+
+//------------------------------------------------------------------------------
+/// Rate limits keyed by host and URL path prefix. A request is subject to
+/// the limit of its host (empty prefix) and to the limit with the longest
+/// prefix of its path, and is delayed until both have a token for it.
+//------------------------------------------------------------------------------
+class RateLimits
+{
+public:
+    static RateLimits& Instance()
+    {
+        static RateLimits s_instance;
+        return s_instance;
+    }
+
+    /// Set the limit of `host` and path `prefix`, or remove it if `rate` <= 0
+    void Configure(const std::string& host, const std::string& prefix,
+                   double rate, double burst, long max_delay_ms)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto& limits = m_limits[host];
+        auto  it     = limits.find(prefix);
+        if (rate <= 0) {
+            if (it != limits.end()) limits.erase(it);
+            if (limits.empty())     m_limits.erase(host);
+        } else if (it != limits.end())
+            it->second.Configure(rate, std::max<double>(1.0, burst), max_delay_ms);
+        else
+            limits.emplace(prefix, TokenBucket(rate, std::max<double>(1.0, burst), max_delay_ms));
+        m_any.store(!m_limits.empty(), std::memory_order_relaxed);
+    }
+
+    /// Current level of a limit. Returns false if there's no such limit
+    bool Level(const std::string& host, const std::string& prefix, double& tokens)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto h = m_limits.find(host);
+        if (h == m_limits.end()) return false;
+        auto it = h->second.find(prefix);
+        if (it == h->second.end()) return false;
+        tokens = it->second.Level(TokenBucket::Clock::now());
+        return true;
+    }
+
+    /// Take tokens for a request to `url`. Returns the delay in ms before it
+    /// may be sent, or -1 (taking nothing) if that's longer than the max
+    /// queueing delay of a limit or than `max_delay_ms`. A `critical`
+    /// request goes ahead of the queued ones
+    long Reserve(const char* url, long max_delay_ms = LONG_MAX, bool critical = false)
+    {
+        if (!m_any.load(std::memory_order_relaxed))
+            return 0;
+        auto host = LatencyStats::Host(url);
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto h = m_limits.find(host);
+        if (h == m_limits.end())
+            return 0;
+
+        // The host's limit and the one of the longest matching prefix
+        auto path = Path(url);
+        TokenBucket* buckets[2] = {nullptr, nullptr};
+        for (auto& kv : h->second)
+            if (kv.first.empty())
+                buckets[0] = &kv.second;
+            else if (!path.compare(0, kv.first.size(), kv.first))
+                buckets[1] = &kv.second;    // Sorted, so longer prefixes come later
+
+        auto now  = TokenBucket::Clock::now();
+        long wait = 0;
+        for (auto b : buckets)
+            if (b) {
+                max_delay_ms = std::min<long>(max_delay_ms, b->MaxDelay());
+                wait         = std::max<long>(wait, b->Wait(now, critical));
+            }
+        if (wait > max_delay_ms)
+            return -1;
+        for (auto b : buckets)
+            if (b) b->Take();
+        return wait;
+    }
+
+    /// Path part of a URL
+    static std::string Path(const char* url)
+    {
+        if (!url) return std::string();
+        auto p = strstr(url, "://");
+        p = p ? p + 3 : url;
+        p += strcspn(p, "/?#");
+        return *p == '/' ? std::string(p, strcspn(p, "?#")) : std::string("/");
+    }
+
+private:
+    RateLimits() : m_any(false) {}
+
+    std::mutex                                                  m_mtx;
+    std::map<std::string, std::map<std::string, TokenBucket>>   m_limits;   ///< host -> prefix ->
+    std::atomic<bool>                                           m_any;
+};
@@ -0,0 +1,320 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-log.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Asynchronous diagnostic log drained by a background thread
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+//------------------------------------------------------------------------------
+/// Diagnostic messages are formatted by the caller directly into a slot of a
+/// bounded lock-free MPSC queue and written out by a background thread, so
+/// that the request path never blocks on a kernel transition or on an
+/// attached debugger. When the queue is full, messages are dropped and
+/// counted rather than stalling the caller. The queue and the sink live in
+/// a heap-allocated `Shared` state co-owned by the writer thread, so a writer
+/// detached at unload never touches a destroyed object.
+//------------------------------------------------------------------------------
+class AsyncLog
+{
+public:
+    enum Sink {
+        NONE,
+        DEBUGGER,   ///< OutputDebugString() on Windows, stderr elsewhere
+        STDERR,
+        FILE_SINK,  ///< Rotating log file
+    };
+
+    static const size_t MSG_SIZE = 256;
+    static const size_t SLOTS    = 4096;  // Must be a power of 2
+
+    static AsyncLog& Instance()
+    {
+        static AsyncLog s_instance;
+        return s_instance;
+    }
+
+    ~AsyncLog() { Stop(); }
+
+    /// Select the output sink. For `FILE_SINK` the file `path` is rotated to
+    /// `path.1` ... `path.N` (N = `max_files`) when it exceeds `max_size` bytes
+    bool Configure(Sink sink, const char* path, long max_size, int max_files)
+    {
+        auto& st = *m_shared;
+        std::lock_guard<std::mutex> g(st.sink_mtx);
+        st.CloseFile();
+        st.sink      = sink;
+        st.path      = path ? path : "";
+        st.max_size  = max_size  > 0 ? max_size  : 10 * 1024 * 1024;
+        st.max_files = max_files > 0 ? max_files : 5;
+        if (sink == FILE_SINK && !st.OpenFile()) {
+            st.sink = NONE;
+            return false;
+        }
+        return true;
+    }
+
+    /// Format a message into the queue. Never blocks
+    void Log(const char* fmt, ...)
+    {
+        auto& st = *m_shared;
+        if (st.sink == NONE) return;
+
+        auto pos = st.enq.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &st.cells[pos & (SLOTS-1)];
+            auto seq  = cell->seq.load(std::memory_order_acquire);
+            auto diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0) {
+                if (st.enq.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                st.dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else
+                pos = st.enq.load(std::memory_order_relaxed);
+        }
+
+        cell->time_us = Now();
+        va_list args;
+        va_start(args, fmt);
+        auto n = vsnprintf(cell->msg, MSG_SIZE, fmt, args);
+        va_end(args);
+        cell->len = n < 0 ? 0 : std::min<int>(n, MSG_SIZE-1);
+        cell->seq.store(pos+1, std::memory_order_release);
+
+        EnsureStarted();
+    }
+
+    uint64_t Dropped() const { return m_shared->dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        uint64_t            time_us;
+        int                 len;
+        char                msg[MSG_SIZE];
+    };
+
+    /// Everything the writer thread touches
+    struct Shared {
+        Shared()
+            : cells(new Cell[SLOTS])
+            , enq(0)
+            , deq(0)
+            , dropped(0)
+            , stop(false)
+            , done(false)
+            , sink(DEBUGGER)
+            , file(nullptr)
+            , file_size(0)
+            , max_size(10 * 1024 * 1024)
+            , max_files(5)
+        {
+            for (size_t i = 0; i < SLOTS; ++i)
+                cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        ~Shared() { CloseFile(); }
+
+        /// Write out all queued messages. Returns false if there were none
+        bool Drain(std::string& batch)
+        {
+            batch.clear();
+            uint64_t n_dropped = dropped.exchange(0, std::memory_order_relaxed);
+            if (n_dropped) {
+                char buf[64];
+                int  n = snprintf(buf, sizeof(buf), "... (%llu log messages dropped)\n",
+                                  (unsigned long long)n_dropped);
+                batch.append(buf, n);
+            }
+            for (;;) {
+                auto& cell = cells[deq & (SLOTS-1)];
+                if (cell.seq.load(std::memory_order_acquire) != deq+1)
+                    break;
+                Format(batch, cell);
+                cell.seq.store(deq + SLOTS, std::memory_order_release);
+                ++deq;
+            }
+            if (batch.empty())
+                return false;
+
+            std::lock_guard<std::mutex> g(sink_mtx);
+            Output(batch);
+            return true;
+        }
+
+        void Output(const std::string& s)
+        {
+            switch (sink) {
+                case NONE:
+                    break;
+                case DEBUGGER:
+#ifdef _WIN32
+                    OutputDebugStringA(s.c_str());
+                    break;
+#endif
+                    // fall through
+                case STDERR:
+                    fwrite(s.c_str(), 1, s.size(), stderr);
+                    fflush(stderr);
+                    break;
+                case FILE_SINK:
+                    if (!file) break;
+                    fwrite(s.c_str(), 1, s.size(), file);
+                    fflush(file);
+                    file_size += long(s.size());
+                    if (file_size >= max_size)
+                        Rotate();
+                    break;
+            }
+        }
+
+        bool OpenFile()
+        {
+            file = fopen(path.c_str(), "ab");
+            if (!file) return false;
+            fseek(file, 0, SEEK_END);
+            file_size = ftell(file);
+            return true;
+        }
+
+        void CloseFile()
+        {
+            if (file) fclose(file);
+            file = nullptr;
+        }
+
+        void Rotate()
+        {
+            CloseFile();
+            char from[512], to[512];
+            snprintf(to, sizeof(to), "%s.%d", path.c_str(), max_files);
+            remove(to);
+            for (int i = max_files-1; i > 0; --i) {
+                snprintf(from, sizeof(from), "%s.%d", path.c_str(), i);
+                snprintf(to,   sizeof(to),   "%s.%d", path.c_str(), i+1);
+                rename(from, to);
+            }
+            snprintf(to, sizeof(to), "%s.1", path.c_str());
+            rename(path.c_str(), to);
+            OpenFile();
+        }
+
+        std::unique_ptr<Cell[]> cells;
+        std::atomic<size_t>     enq;
+        size_t                  deq;        ///< Only touched by the log thread
+        std::atomic<uint64_t>   dropped;
+        std::atomic<bool>       stop;
+        std::atomic<bool>       done;
+
+        std::mutex              sink_mtx;
+        std::atomic<Sink>       sink;
+        std::string             path;
+        FILE*                   file;
+        long                    file_size;
+        long                    max_size;
+        int                     max_files;
+    };
+
+    AsyncLog() : m_shared(std::make_shared<Shared>()), m_started(false) {}
+
+    static uint64_t Now()
+    {
+        using namespace std::chrono;
+        return uint64_t(duration_cast<microseconds>(system_clock::now().time_since_epoch()).count());
+    }
+
+    void EnsureStarted()
+    {
+        if (m_started.load(std::memory_order_acquire)) return;
+        std::lock_guard<std::mutex> g(m_thread_mtx);
+        if (m_started.load(std::memory_order_relaxed)) return;
+        auto shared = m_shared;
+        m_thread  = std::thread([shared] { Run(*shared); });
+        m_started.store(true, std::memory_order_release);
+    }
+
+    /// Don't join(): when the DLL is unloaded this runs under the loader lock,
+    /// which the exiting thread would need. Wait until it's done with our code.
+    /// A writer still busy after the wait keeps the shared state alive and
+    /// closes the file itself
+    void Stop()
+    {
+        std::lock_guard<std::mutex> g(m_thread_mtx);
+        auto& st = *m_shared;
+        if (!m_started.load()) {
+            std::lock_guard<std::mutex> sg(st.sink_mtx);
+            st.CloseFile();
+            return;
+        }
+        st.stop.store(true);
+        for (int i = 0; i < 200 && !st.done.load(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        m_thread.detach();
+        m_started.store(false);
+    }
+
+    static void Run(Shared& st)
+    {
+        std::string batch;
+        while (!st.stop.load(std::memory_order_relaxed)) {
+            if (!st.Drain(batch))
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        st.Drain(batch);
+        {
+            std::lock_guard<std::mutex> g(st.sink_mtx);
+            st.CloseFile();
+        }
+        st.done.store(true);
+    }
+
+    static void Format(std::string& out, const Cell& cell)
+    {
+        char   buf[32];
+        auto   secs = time_t(cell.time_us / 1000000);
+        struct tm tm;
+#ifdef _WIN32
+        gmtime_s(&tm, &secs);
+#else
+        gmtime_r(&secs, &tm);
+#endif
+        int n = snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%06u ",
+                         tm.tm_hour, tm.tm_min, tm.tm_sec, unsigned(cell.time_us % 1000000));
+        out.append(buf, n);
+        out.append(cell.msg, cell.len);
+        if (!cell.len || cell.msg[cell.len-1] != '\n')
+            out.push_back('\n');
+    }
+
+    std::shared_ptr<Shared> m_shared;
+    std::mutex              m_thread_mtx;
+    std::thread             m_thread;
+    std::atomic<bool>       m_started;
+};
@@ -0,0 +1,167 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-longpoll.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Long-poll requests re-armed by the background engine
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "curl-mt4-engine.h"
+#include "curl-mt4-queue.h"
+#include <curl/curl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+/// A GET request that the engine reissues as soon as its response arrives,
+/// queueing response bodies for the handle's owner. The easy handle is set up
+/// once and reused, so each cycle reuses the connection too. A request the
+/// server holds for longer than `max_wait` times out and is reissued; an HTTP
+/// 204 or 304 response is not queued. Failed requests (transport errors,
+/// 4xx and 5xx) are retried with an exponential backoff, and so are requests
+/// answered within `MIN_HOLD_MS` with no update (a server that doesn't hold
+/// them). Requests are reissued at most every `MIN_REARM_MS`.
+//------------------------------------------------------------------------------
+class LongPoll : public Engine::Job
+{
+public:
+    static const size_t QUEUE_SIZE     = 1024;
+    static const long   MIN_BACKOFF_MS = 250;
+    static const long   MAX_BACKOFF_MS = 30000;
+    static const long   GRACE_MS       = 5000;  ///< Allowance over max_wait for the response
+    static const long   MIN_HOLD_MS    = 1000;  ///< A quicker "no update" isn't long-polling
+    static const long   MIN_REARM_MS   = 100;   ///< Shortest interval between requests
+
+    /// @param max_wait_secs  longest time the server may hold the request
+    /// @param on_change_only queue a body only if it differs from the last one
+    LongPoll(const std::string& url, const std::vector<std::string>& headers,
+             int max_wait_secs, bool on_change_only)
+        : m_url(url)
+        , m_headers(headers)
+        , m_easy(nullptr)
+        , m_list(nullptr)
+        , m_timeout_ms(std::max<int>(1, max_wait_secs) * 1000L + GRACE_MS)
+        , m_on_change(on_change_only)
+        , m_last_hash(0)
+        , m_has_last(false)
+        , m_backoff(0)
+        , m_queue(QUEUE_SIZE)
+        , m_closed(false)
+    {
+        m_err[0] = '\0';
+    }
+
+    ~LongPoll()
+    {
+        if (m_list) curl_slist_free_all(m_list);
+        if (m_easy) curl_easy_cleanup(m_easy);
+    }
+
+    CURL* Start() override
+    {
+        m_body.clear();
+        m_err[0] = '\0';
+        m_start  = std::chrono::steady_clock::now();
+        if (m_easy)
+            return m_easy;              // Already set up
+        if (!(m_easy = curl_easy_init()))
+            return nullptr;
+
+        for (auto& h : m_headers)
+            if (!h.empty()) m_list = curl_slist_append(m_list, h.c_str());
+
+        curl_easy_setopt(m_easy, CURLOPT_URL,            m_url.c_str());
+        curl_easy_setopt(m_easy, CURLOPT_HTTPHEADER,     m_list);
+        curl_easy_setopt(m_easy, CURLOPT_WRITEFUNCTION,  OnData);
+        curl_easy_setopt(m_easy, CURLOPT_WRITEDATA,      this);
+        curl_easy_setopt(m_easy, CURLOPT_ERRORBUFFER,    m_err);
+        curl_easy_setopt(m_easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(m_easy, CURLOPT_CONNECTTIMEOUT, 7L);
+        curl_easy_setopt(m_easy, CURLOPT_TIMEOUT_MS,     m_timeout_ms);
+        curl_easy_setopt(m_easy, CURLOPT_TCP_KEEPALIVE,  1L);
+        curl_easy_setopt(m_easy, CURLOPT_NOSIGNAL,       1L);
+        return m_easy;
+    }
+
+    long Done(CURLcode res) override
+    {
+        long status = 0;
+        curl_easy_getinfo(m_easy, CURLINFO_RESPONSE_CODE, &status);
+        auto held = long(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - m_start).count());
+
+        if (res == CURLE_OPERATION_TIMEDOUT)
+            return Rearm(held);         // Server held the request with no update
+        if (res != CURLE_OK || status >= 400)
+            return Backoff();
+
+        bool update = false;
+        if (status / 100 == 2 && status != 204) {
+            auto h = Hash(m_body);
+            update = !m_has_last || h != m_last_hash;
+            if (update || !m_on_change)
+                m_queue.Push(m_body);   // Swaps in the buffer of a consumed body
+            m_last_hash = h;
+            m_has_last  = true;
+        }
+        if (!update && held < MIN_HOLD_MS)
+            return Backoff();
+        return Rearm(held);
+    }
+
+    void Finished() override { m_closed.store(true); }
+
+    /// Consumer side, see `CurlNextPoll()`
+    SpscQueue<std::string>& Queue()        { return m_queue;         }
+    bool                    Closed() const { return m_closed.load(); }
+
+private:
+    /// Reissue the request that took `held` ms
+    long Rearm(long held)
+    {
+        m_backoff = 0;
+        return std::max<long>(0, MIN_REARM_MS - held);
+    }
+
+    long Backoff()
+    {
+        m_backoff = m_backoff ? std::min<long>(m_backoff * 2, long(MAX_BACKOFF_MS)) : MIN_BACKOFF_MS;
+        return m_backoff;
+    }
+
+    /// FNV-1a
+    static uint64_t Hash(const std::string& s)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (auto c : s) { h ^= uint8_t(c); h *= 1099511628211ull; }
+        return h;
+    }
+
+    static size_t OnData(char* p, size_t size, size_t nmemb, void* userp)
+    {
+        auto self = static_cast<LongPoll*>(userp);
+        auto n    = size * nmemb;
+        self->m_body.append(p, n);
+        return n;
+    }
+
+    std::string              m_url;
+    std::vector<std::string> m_headers;
+    CURL*                    m_easy;
+    struct curl_slist*       m_list;
+    long                     m_timeout_ms;
+    bool                     m_on_change;
+    uint64_t                 m_last_hash;
+    bool                     m_has_last;
+    long                     m_backoff;     ///< Current retry delay, 0 after a success
+    std::chrono::steady_clock::time_point m_start;  ///< Of the current request
+    std::string              m_body;
+    SpscQueue<std::string>   m_queue;
+    std::atomic<bool>        m_closed;
+    char                     m_err[CURL_ERROR_SIZE];
+};
@@ -0,0 +1,131 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-mirror.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Process-wide latency-aware selection among mirror base URLs
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+/// A base URL ("https://host[:port][/path]") equivalent to others, with the
+/// exponentially weighted moving averages of its latency (of successful
+/// requests) and of its failure rate (transport errors and 5xx responses).
+//------------------------------------------------------------------------------
+struct Mirror
+{
+    explicit Mirror(const std::string& url)
+        : base(url), rtt_ms(0), errors(0), samples(0)
+    {}
+
+    const std::string                       base;
+    double                                  rtt_ms;
+    double                                  errors;     ///< 0..1
+    uint64_t                                samples;
+    std::chrono::steady_clock::time_point   tried;      ///< Last selected
+};
+
+//------------------------------------------------------------------------------
+/// Registry of mirrors keyed by base URL, shared by all handles. A request
+/// is routed to the mirror with the lowest expected cost: its latency plus
+/// its failure rate times `FAILURE_MS`. A mirror that has never succeeded is
+/// costed at the latency of the slowest one that has. A mirror that wasn't
+/// selected for `PROBE_MS` (or never was) gets the next request as a probe,
+/// so that the statistics of the others keep up as their relative latency
+/// shifts. Mirrors are never deleted.
+//------------------------------------------------------------------------------
+class Mirrors
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static const long PROBE_MS   = 10000;
+    static const long FAILURE_MS = 1000;    ///< Cost of a failed request
+    static constexpr double ALPHA = 0.2;    ///< Weight of the latest sample
+
+    static Mirrors& Instance()
+    {
+        static Mirrors s_instance;
+        return s_instance;
+    }
+
+    Mirror* Get(std::string base)
+    {
+        base.erase(0, base.find_first_not_of(" \t"));
+        while (!base.empty() && strchr(" \t\r/", base.back())) base.pop_back();
+        if (base.empty()) return nullptr;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto& m = m_mirrors[base];
+        if (!m) m.reset(new Mirror(base));
+        return m.get();
+    }
+
+    /// Pick the mirror of a request among `set` (not empty)
+    Mirror* Select(const std::vector<Mirror*>& set)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto    now     = Clock::now();
+        Mirror* best    = nullptr;
+        Mirror* probe   = nullptr;
+        double  slowest = 0;
+        for (auto m : set)
+            slowest = std::max<double>(slowest, m->rtt_ms);
+        for (auto m : set) {
+            if (now - m->tried >= std::chrono::milliseconds(long(PROBE_MS)) &&
+                (!probe || m->tried < probe->tried))
+                probe = m;
+            if (m->samples && (!best || Cost(*m, slowest) < Cost(*best, slowest)))
+                best = m;
+        }
+        auto pick   = probe ? probe : best ? best : set.front();
+        pick->tried = now;
+        return pick;
+    }
+
+    /// Record the outcome of a request sent to `m`
+    void Record(Mirror* m, uint64_t usec, bool failure)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!failure)
+            m->rtt_ms = m->rtt_ms > 0 ? m->rtt_ms + ALPHA * (usec / 1000.0 - m->rtt_ms) : usec / 1000.0;
+        m->errors += ALPHA * ((failure ? 1 : 0) - m->errors);
+        ++m->samples;
+    }
+
+    /// URL of a request to `url` sent to mirror `to`: a path is appended to
+    /// the mirror's base, and the base of a URL of one of the mirrors of
+    /// `set` is replaced. Returns "" if `url` is neither
+    static std::string Resolve(const std::string& url, const std::vector<Mirror*>& set, const Mirror* to)
+    {
+        if (!url.empty() && url[0] == '/')
+            return to->base + url;
+        for (auto m : set) {
+            auto& b = m->base;
+            if (!url.compare(0, b.size(), b) && (url.size() == b.size() || strchr("/?#", url[b.size()])))
+                return to->base + url.substr(b.size());
+        }
+        return std::string();
+    }
+
+private:
+    Mirrors() = default;
+
+    /// `slowest` stands in for the latency of a mirror without a success
+    static double Cost(const Mirror& m, double slowest)
+    {
+        return (m.rtt_ms > 0 ? m.rtt_ms : slowest) + m.errors * FAILURE_MS;
+    }
+
+    std::mutex                                      m_mtx;
+    std::map<std::string, std::unique_ptr<Mirror>>  m_mirrors;
+};
@@ -0,0 +1,110 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-mock.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     In-memory fixture transport with a synthetic latency model
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+/// Canned responses keyed by method and URL pattern. Patterns are globs where
+/// `*` matches any sequence of characters and `?` matches one character;
+/// rules are tried in the order they were added. Every response is delayed by
+/// a latency sampled from the configured distribution, using a fixed seed so
+/// that runs are reproducible.
+//------------------------------------------------------------------------------
+class MockTransport
+{
+public:
+    enum Model { NONE, CONSTANT, UNIFORM, NORMAL, LOGNORMAL };
+
+    struct Rule {
+        int                      method;    ///< CurlMethod or -1 for any
+        std::string              pattern;
+        int                      status;
+        std::vector<std::string> headers;
+        std::string              body;
+    };
+
+    MockTransport() : m_model(NONE), m_p1(0), m_p2(0), m_rng(SEED) {}
+
+    bool Empty() const { return m_rules.empty(); }
+    void Clear()       { m_rules.clear(); }
+
+    void Add(Rule&& rule) { m_rules.push_back(std::move(rule)); }
+
+    /// CONSTANT: `p1` ms; UNIFORM: `p1`..`p2` ms; NORMAL: mean `p1`, stddev
+    /// `p2` ms; LOGNORMAL: median `p1` ms, shape (sigma) `p2`
+    void Latency(Model model, double p1, double p2)
+    {
+        m_model = model;
+        m_p1    = std::max<double>(0.0, p1);
+        m_p2    = std::max<double>(0.0, p2);
+        m_rng.seed(SEED);
+    }
+
+    const Rule* Match(int method, const std::string& url) const
+    {
+        for (auto& r : m_rules)
+            if ((r.method < 0 || r.method == method) && Glob(r.pattern.c_str(), url.c_str()))
+                return &r;
+        return nullptr;
+    }
+
+    /// Sample the next response delay in usec
+    uint64_t Delay()
+    {
+        double ms;
+        switch (m_model) {
+            case CONSTANT:  ms = m_p1; break;
+            case UNIFORM:   ms = std::uniform_real_distribution<double>(m_p1, std::max<double>(m_p1, m_p2))(m_rng); break;
+            // Both distributions require a positive spread; zero means no jitter
+            case NORMAL:    ms = m_p2 > 0
+                               ? std::normal_distribution<double>(m_p1, m_p2)(m_rng)
+                               : m_p1; break;
+            case LOGNORMAL: ms = m_p1 > 0 && m_p2 > 0
+                               ? std::lognormal_distribution<double>(std::log(m_p1), m_p2)(m_rng)
+                               : m_p1; break;
+            default:        ms = 0; break;
+        }
+        return ms > 0 ? uint64_t(ms * 1000) : 0;
+    }
+
+    static bool Glob(const char* pat, const char* s)
+    {
+        const char* star = nullptr;
+        const char* back = nullptr;
+        while (*s) {
+            if (*pat == '*') {
+                star = ++pat;
+                back = s;
+            } else if (*pat == '?' || *pat == *s) {
+                ++pat;
+                ++s;
+            } else if (star) {
+                pat = star;
+                s   = ++back;
+            } else
+                return false;
+        }
+        while (*pat == '*') ++pat;
+        return !*pat;
+    }
+
+private:
+    static const unsigned SEED = 5489u;
+
+    std::vector<Rule> m_rules;
+    Model             m_model;
+    double            m_p1;
+    double            m_p2;
+    std::mt19937_64   m_rng;
+};
@@ -0,0 +1,198 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-ndjson.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Newline-delimited JSON (NDJSON) streaming client
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "curl-mt4-engine.h"
+#include "curl-mt4-queue.h"
+#include <curl/curl.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+/// Splits a byte stream into lines as it arrives. Newlines are located with
+/// `memchr()`, which the C runtime vectorizes, and lines contained in a chunk
+/// are passed on without copying; only an incomplete line at the end of a
+/// chunk is carried over to the next `Feed()`. A trailing CR is stripped and
+/// empty lines are skipped. A line longer than `max_line` is discarded.
+//------------------------------------------------------------------------------
+class LineSplitter
+{
+public:
+    explicit LineSplitter(size_t max_line) : m_max(max_line), m_skip(false), m_dropped(0) {}
+
+    void     Reset()         { m_line.clear(); m_skip = false; }
+    uint64_t Dropped() const { return m_dropped; }
+
+    /// Parse `n` bytes calling `f(const char*, size_t)` for every complete line
+    template <class F>
+    void Feed(const char* p, size_t n, F&& f)
+    {
+        auto end = p + n;
+        while (p < end) {
+            auto nl = static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+            if (!nl) {
+                if (!m_skip && m_line.size() + size_t(end - p) <= m_max)
+                    m_line.append(p, end);
+                else
+                    Overflow();
+                return;
+            }
+            if (m_skip)
+                m_skip = false;         // End of an oversized line
+            else if (m_line.empty()) {
+                if (size_t(nl - p) <= m_max) Line(p, size_t(nl - p), f);
+                else                         ++m_dropped;
+            } else if (m_line.size() + size_t(nl - p) <= m_max) {
+                m_line.append(p, nl);
+                Line(m_line.c_str(), m_line.size(), f);
+                m_line.clear();
+            } else {
+                Overflow();
+                m_skip = false;
+            }
+            p = nl + 1;
+        }
+    }
+
+private:
+    template <class F>
+    void Line(const char* s, size_t n, F& f)
+    {
+        if (n && s[n-1] == '\r') --n;
+        if (n) f(s, n);
+    }
+
+    void Overflow()
+    {
+        if (!m_skip) ++m_dropped;
+        m_skip = true;
+        m_line.clear();
+    }
+
+    std::string m_line;     ///< Incomplete line carried over between chunks
+    size_t      m_max;
+    bool        m_skip;     ///< Discarding the rest of an oversized line
+    uint64_t    m_dropped;
+};
+
+//------------------------------------------------------------------------------
+/// A streaming NDJSON response read by the engine. Each record is queued for
+/// the handle's owner as soon as its newline arrives, so the response is
+/// never accumulated in memory. Unlike an event stream there's no way to
+/// resume, so the stream isn't reopened when the transfer ends. A partial
+/// last line is only queued if the response completed.
+//------------------------------------------------------------------------------
+class JsonStream : public Engine::Job
+{
+public:
+    static const size_t QUEUE_SIZE = 4096;
+    static const size_t MAX_RECORD = 16 * 1024 * 1024;
+
+    JsonStream(const std::string& url, const std::vector<std::string>& headers)
+        : m_url(url)
+        , m_headers(headers)
+        , m_easy(nullptr)
+        , m_list(nullptr)
+        , m_splitter(MAX_RECORD)
+        , m_queue(QUEUE_SIZE)
+        , m_status(0)
+        , m_result(-1)
+        , m_final_status(0)
+        , m_closed(false)
+    {
+        m_err[0] = '\0';
+    }
+
+    ~JsonStream()
+    {
+        if (m_list) curl_slist_free_all(m_list);
+        if (m_easy) curl_easy_cleanup(m_easy);
+    }
+
+    CURL* Start() override
+    {
+        if (!(m_easy = curl_easy_init())) {
+            m_result.store(CURLE_FAILED_INIT);
+            return nullptr;
+        }
+
+        for (auto& h : m_headers)
+            if (!h.empty()) m_list = curl_slist_append(m_list, h.c_str());
+        m_list = curl_slist_append(m_list, "Accept: application/x-ndjson");
+
+        curl_easy_setopt(m_easy, CURLOPT_URL,            m_url.c_str());
+        curl_easy_setopt(m_easy, CURLOPT_HTTPHEADER,     m_list);
+        curl_easy_setopt(m_easy, CURLOPT_WRITEFUNCTION,  OnData);
+        curl_easy_setopt(m_easy, CURLOPT_WRITEDATA,      this);
+        curl_easy_setopt(m_easy, CURLOPT_ERRORBUFFER,    m_err);
+        curl_easy_setopt(m_easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(m_easy, CURLOPT_CONNECTTIMEOUT, 7L);
+        curl_easy_setopt(m_easy, CURLOPT_TCP_KEEPALIVE,  1L);
+        curl_easy_setopt(m_easy, CURLOPT_NOSIGNAL,       1L);
+        return m_easy;
+    }
+
+    long Done(CURLcode res) override
+    {
+        long status = 0;
+        curl_easy_getinfo(m_easy, CURLINFO_RESPONSE_CODE, &status);
+        // A last record without a trailing newline, unless the connection
+        // was lost in the middle of it
+        const char nl = '\n';
+        if (res == CURLE_OK && status / 100 == 2)
+            m_splitter.Feed(&nl, 1, [this](const char* p, size_t n) { Push(p, n); });
+        m_final_status.store(status);
+        m_result.store(res);
+        return -1;
+    }
+
+    void Finished() override { m_closed.store(true); }
+
+    /// Consumer side, see `CurlNextRecord()`
+    SpscQueue<std::string>& Queue()        { return m_queue;         }
+    bool                    Closed() const { return m_closed.load(); }
+    /// CURLcode the response ended with, or -1 while it's being read
+    int                     Result() const { return m_result.load(); }
+    /// HTTP status of the response, 0 if none was received
+    long                    Status() const { return m_final_status.load(); }
+
+private:
+    void Push(const char* p, size_t n)
+    {
+        m_record.assign(p, n);
+        m_queue.Push(m_record);         // Swaps in the buffer of a consumed record
+    }
+
+    static size_t OnData(char* p, size_t size, size_t nmemb, void* userp)
+    {
+        auto self = static_cast<JsonStream*>(userp);
+        auto n    = size * nmemb;
+        if (!self->m_status)
+            curl_easy_getinfo(self->m_easy, CURLINFO_RESPONSE_CODE, &self->m_status);
+        if (self->m_status / 100 != 2)
+            return n;                   // Error page, not a record stream
+        self->m_splitter.Feed(p, n, [self](const char* s, size_t len) { self->Push(s, len); });
+        return n;
+    }
+
+    std::string              m_url;
+    std::vector<std::string> m_headers;
+    CURL*                    m_easy;
+    struct curl_slist*       m_list;
+    LineSplitter             m_splitter;
+    std::string              m_record;
+    SpscQueue<std::string>   m_queue;
+    long                     m_status;
+    std::atomic<int>         m_result;
+    std::atomic<long>        m_final_status;
+    std::atomic<bool>        m_closed;
+    char                     m_err[CURL_ERROR_SIZE];
+};
@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-queue.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Bounded lock-free single-producer/single-consumer queue
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+/// Ring of `capacity` (rounded up to a power of 2) slots passing items from
+/// the engine thread (producer) to API calls on a handle (consumer, which
+/// are serialized by the handle's lock). Items are moved in and out of the
+/// slots, so a slot's buffers are reused once they've grown. When the queue
+/// is full `Push()` fails and the item is counted as dropped.
+//------------------------------------------------------------------------------
+template <class T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity)
+        : m_size(RoundUp(capacity))
+        , m_slots(new T[m_size])
+        , m_head(0)
+        , m_tail(0)
+        , m_dropped(0)
+    {}
+
+    /// Producer: move `item` into the queue
+    bool Push(T& item)
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == m_size) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        std::swap(m_slots[head & (m_size-1)], item);
+        m_head.store(head+1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer: oldest item, or nullptr if the queue is empty
+    T* Front()
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_slots[tail & (m_size-1)];
+    }
+
+    /// Consumer: remove the item returned by `Front()`
+    void Pop() { m_tail.store(m_tail.load(std::memory_order_relaxed)+1, std::memory_order_release); }
+
+    size_t   Size()    const { return size_t(m_head.load() - m_tail.load()); }
+    uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    static size_t RoundUp(size_t n)
+    {
+        size_t r = 2;
+        while (r < n) r <<= 1;
+        return r;
+    }
+
+    const size_t          m_size;
+    std::unique_ptr<T[]>  m_slots;
+    std::atomic<uint64_t> m_head;   ///< Next slot to write (producer)
+    std::atomic<uint64_t> m_tail;   ///< Next slot to read  (consumer)
+    std::atomic<uint64_t> m_dropped;
+};
@@ -0,0 +1,286 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-replay.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Append-only request/response store for record and replay
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+/// Read-only memory mapping of a whole file
+//------------------------------------------------------------------------------
+class MappedFile
+{
+public:
+    MappedFile() : m_data(nullptr), m_size(0)
+#ifdef _WIN32
+        , m_file(INVALID_HANDLE_VALUE), m_map(nullptr)
+#endif
+    {}
+
+    ~MappedFile() { Close(); }
+
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(m_file, &sz)) { Close(); return false; }
+        m_size = size_t(sz.QuadPart);
+        if (!m_size) return true;
+        m_map  = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        m_data = m_map ? static_cast<const char*>(MapViewOfFile(m_map, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0) { close(fd); return false; }
+        m_size = size_t(st.st_size);
+        if (m_size) {
+            auto p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            m_data = p == MAP_FAILED ? nullptr : static_cast<const char*>(p);
+        }
+        close(fd);
+        if (!m_size) return true;
+#endif
+        if (!m_data) { Close(); return false; }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_map)  CloseHandle(m_map);
+        if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+        m_map  = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data) munmap(const_cast<char*>(m_data), m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const char* Data() const { return m_data; }
+    size_t      Size() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* m_data;
+    size_t      m_size;
+#ifdef _WIN32
+    HANDLE      m_file;
+    HANDLE      m_map;
+#endif
+};
+
+//------------------------------------------------------------------------------
+/// A file of request/response records. In `RECORD` mode records are appended
+/// to the file. In `PLAY` mode the file is memory mapped and indexed by a hash
+/// of the request's method, URL and body, and `Find()` returns the responses
+/// recorded for a request in their original order, repeating the last one
+/// once they're exhausted. Request headers are recorded but not matched, as
+/// they typically carry timestamps and signatures.
+///
+/// Each record is a `Record` header followed by the URL, request headers,
+/// request body, response headers and response body. A truncated record at
+/// the end of the file (e.g. after a crash) is ignored.
+//------------------------------------------------------------------------------
+class ReplayStore
+{
+public:
+    enum Mode { OFF, RECORD, PLAY };
+
+    struct Record {
+        uint32_t magic;
+        uint32_t size;          ///< Total size of the record including this header
+        uint64_t key;           ///< Hash of method, URL and request body
+        uint64_t time_us;       ///< Wall clock time of the request
+        uint32_t latency_us;
+        int32_t  result;        ///< CURLcode
+        int32_t  status;        ///< HTTP status
+        int32_t  method;
+        uint32_t len[5];        ///< URL, req headers, req body, resp headers, resp body
+    };
+
+    struct Response {
+        int         result;
+        int         status;
+        uint32_t    latency_us;
+        const char* headers;    ///< '\n' delimited response headers
+        size_t      headers_len;
+        const char* body;
+        size_t      body_len;
+    };
+
+    static const uint32_t MAGIC = 0x31524d43;   // "CMR1"
+
+    /// Get a store shared by all handles using the same file and mode
+    static std::shared_ptr<ReplayStore> Open(const std::string& path, Mode mode)
+    {
+        static std::mutex s_mtx;
+        static std::map<std::pair<std::string, Mode>, std::weak_ptr<ReplayStore>> s_stores;
+
+        std::lock_guard<std::mutex> g(s_mtx);
+        auto& w = s_stores[std::make_pair(path, mode)];
+        auto  p = w.lock();
+        if (p) return p;
+        p.reset(new ReplayStore(mode));
+        if (!(mode == RECORD ? p->OpenRecord(path) : p->OpenPlay(path)))
+            return nullptr;
+        w = p;
+        return p;
+    }
+
+    ~ReplayStore() { if (m_out) fclose(m_out); }
+
+    Mode   GetMode() const { return m_mode;    }
+    size_t Count()   const { return m_count;   }
+
+    bool Append(int method, const std::string& url, const std::string& req_headers,
+                const char* body, size_t body_len, int result, int status, uint32_t latency_us,
+                uint64_t time_us, const std::string& resp_headers, const std::string& resp_body)
+    {
+        Record r;
+        memset(&r, 0, sizeof(r));
+        r.magic      = MAGIC;
+        r.key        = Key(method, url.c_str(), url.size(), body, body_len);
+        r.time_us    = time_us;
+        r.latency_us = latency_us;
+        r.result     = result;
+        r.status     = status;
+        r.method     = method;
+        r.len[0]     = uint32_t(url.size());
+        r.len[1]     = uint32_t(req_headers.size());
+        r.len[2]     = uint32_t(body_len);
+        r.len[3]     = uint32_t(resp_headers.size());
+        r.len[4]     = uint32_t(resp_body.size());
+        r.size       = uint32_t(sizeof(r) + r.len[0] + r.len[1] + r.len[2] + r.len[3] + r.len[4]);
+
+        std::lock_guard<std::mutex> g(m_mtx);
+        if (!m_out) return false;
+        fwrite(&r, sizeof(r), 1, m_out);
+        fwrite(url.c_str(),          1, url.size(),          m_out);
+        fwrite(req_headers.c_str(),  1, req_headers.size(),  m_out);
+        if (body_len) fwrite(body,   1, body_len,            m_out);
+        fwrite(resp_headers.c_str(), 1, resp_headers.size(), m_out);
+        fwrite(resp_body.c_str(),    1, resp_body.size(),    m_out);
+        ++m_count;
+        return fflush(m_out) == 0;
+    }
+
+    bool Find(int method, const std::string& url, const char* body, size_t body_len, Response& out)
+    {
+        auto key = Key(method, url.c_str(), url.size(), body, body_len);
+
+        std::lock_guard<std::mutex> g(m_mtx);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) return false;
+
+        // Responses to this request that weren't served yet, last one repeats
+        auto& e    = it->second;
+        auto  from = std::min<size_t>(e.next, e.offsets.size()-1);
+        for (auto i = from; i < e.offsets.size(); ++i) {
+            auto   p = m_file.Data() + e.offsets[i];
+            auto   s = p + sizeof(Record);
+            Record r;
+            memcpy(&r, p, sizeof(r));   // Records aren't aligned in the file
+            if (r.method != method || r.len[0] != url.size() || r.len[2] != body_len ||
+                memcmp(s, url.c_str(), url.size()) != 0 ||
+                (body_len && memcmp(s + r.len[0] + r.len[1], body, body_len) != 0))
+                continue;   // Hash collision
+
+            e.next          = i + 1;
+            out.result      = r.result;
+            out.status      = r.status;
+            out.latency_us  = r.latency_us;
+            out.headers     = s + r.len[0] + r.len[1] + r.len[2];
+            out.headers_len = r.len[3];
+            out.body        = out.headers + r.len[3];
+            out.body_len    = r.len[4];
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct Entry {
+        Entry() : next(0) {}
+        std::vector<size_t> offsets;
+        size_t              next;
+    };
+
+    explicit ReplayStore(Mode mode) : m_mode(mode), m_out(nullptr), m_count(0) {}
+
+    /// FNV-1a
+    static uint64_t Key(int method, const char* url, size_t url_len, const char* body, size_t body_len)
+    {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](const char* p, size_t n) {
+            for (size_t i = 0; i < n; ++i) { h ^= uint8_t(p[i]); h *= 1099511628211ull; }
+        };
+        mix(reinterpret_cast<const char*>(&method), sizeof(method));
+        mix(url, url_len);
+        mix("\n", 1);
+        if (body) mix(body, body_len);
+        return h;
+    }
+
+    bool OpenRecord(const std::string& path)
+    {
+        m_out = fopen(path.c_str(), "ab");
+        return m_out != nullptr;
+    }
+
+    bool OpenPlay(const std::string& path)
+    {
+        if (!m_file.Open(path)) return false;
+        auto   p   = m_file.Data();
+        size_t pos = 0, end = m_file.Size();
+        while (end - pos >= sizeof(Record)) {
+            Record r;
+            memcpy(&r, p + pos, sizeof(r));
+            if (r.magic != MAGIC || r.size < sizeof(r) || r.size > end - pos)
+                break;
+            m_index[r.key].offsets.push_back(pos);
+            pos += r.size;
+            ++m_count;
+        }
+        return true;
+    }
+
+    Mode                                m_mode;
+    std::mutex                          m_mtx;
+    FILE*                               m_out;
+    MappedFile                          m_file;
+    std::unordered_map<uint64_t, Entry> m_index;
+    size_t                              m_count;
+};
@@ -0,0 +1,610 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-request.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Requests executed on the background engine with a retry policy
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "curl-mt4.h"
+#include "curl-mt4-breaker.h"
+#include "curl-mt4-engine.h"
+#include "curl-mt4-flight.h"
+#include "curl-mt4-limit.h"
+#include "curl-mt4-mirror.h"
+#include "curl-mt4-stats.h"
+#include "curl-mt4-timeout.h"
+#include "curl-mt4-util.h"
+#include <curl/curl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+//------------------------------------------------------------------------------
+/// Set up `h` for `method`, appending the request headers it implies to
+/// `req_headers`. Returns ERR_NO_POST_DATA if the method requires a body
+//------------------------------------------------------------------------------
+inline int SetMethod(CURL* h, int method, const char* post_data, std::vector<std::string>& req_headers)
+{
+    switch (method) {
+        case CurlMethod::GET:
+            break;
+        case CurlMethod::POST: {
+            curl_easy_setopt(h, CURLOPT_POST, 1L);
+            req_headers.emplace_back("Expect:");
+            if (post_data) {
+                curl_easy_setopt(h, CURLOPT_POSTFIELDS,    post_data);
+                curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, -1L);
+            } else
+                req_headers.emplace_back("Content-Type:");
+            break;
+        }
+        case CurlMethod::POST_JSON: {
+            req_headers.emplace_back("Content-Type: application/json");
+            if (post_data == nullptr)
+              return ERR_NO_POST_DATA;
+            curl_easy_setopt(h, CURLOPT_POSTFIELDS,    post_data);
+            curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, -1L);
+            break;
+        }
+        case CurlMethod::POST_FORM: {
+            if (post_data == nullptr)
+                return ERR_NO_POST_DATA;
+
+            req_headers.emplace_back("Content-Type: application/x-www-form-urlencoded");
+            curl_easy_setopt(h, CURLOPT_POSTFIELDS, post_data);
+            curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, -1L);
+            break;
+        }
+        case CurlMethod::DEL:
+            curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, "DELETE");
+            break;
+        case CurlMethod::PUT:
+            curl_easy_setopt(h, CURLOPT_UPLOAD, 1L);
+            break;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Cancellation of a handle's requests, safe to use from any thread. Each
+/// request holds a `Ticket` of the generation it started in, and `Cancel()`
+/// starts a new generation, aborting all requests started before it.
+//------------------------------------------------------------------------------
+class CancelToken
+{
+public:
+    struct Ticket {
+        std::shared_ptr<std::atomic<unsigned>> gen;
+        unsigned                               issued;
+
+        bool Cancelled() const { return gen && gen->load(std::memory_order_relaxed) != issued; }
+    };
+
+    CancelToken() : m_gen(std::make_shared<std::atomic<unsigned>>(0)) {}
+
+    void   Cancel() const { m_gen->fetch_add(1); }
+    Ticket Issue()  const { return Ticket{m_gen, m_gen->load()}; }
+
+    /// CURLOPT_XFERINFOFUNCTION aborting the transfer of a cancelled `Ticket`
+    static int OnProgress(void* ticket, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+    {
+        return static_cast<const Ticket*>(ticket)->Cancelled() ? 1 : 0;
+    }
+
+private:
+    std::shared_ptr<std::atomic<unsigned>> m_gen;
+};
+
+/// Absolute deadline of a request, across its retries and redirects
+using Deadline = std::chrono::steady_clock::time_point;
+
+inline Deadline NoDeadline() { return (Deadline::max)(); }
+
+/// Time left until `deadline` in ms (LONG_MAX if there's none)
+inline long TimeLeft(Deadline deadline)
+{
+    if (deadline == NoDeadline()) return LONG_MAX;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  deadline - std::chrono::steady_clock::now()).count();
+    return long(std::max<decltype(ms)>(ms, 0));
+}
+
+/// Check that a completed transfer's outcome `res` came from the server
+/// rather than from the request giving up on it: cancelled, or timed out
+/// by its own `deadline`. Only such outcomes are shared with a flight
+inline bool ServerOutcome(int res, Deadline deadline)
+{
+    return res != CURLE_ABORTED_BY_CALLBACK &&
+           !(res == CURLE_OPERATION_TIMEDOUT && TimeLeft(deadline) <= 0);
+}
+
+//------------------------------------------------------------------------------
+/// Set the connect and total timeouts of a transfer on `h`, which may not
+/// run past `deadline`. The host's `adaptive` timeout, if there's one,
+/// replaces `timeout_secs`. Returns false if the deadline has passed
+//------------------------------------------------------------------------------
+inline bool SetTimeouts(CURL* h, int timeout_secs, Deadline deadline, AdaptiveTimeout* adaptive)
+{
+    static const long CONNECT_TIMEOUT_MS = 7000;
+    auto total   = timeout_secs > 0 ? timeout_secs * 1000L : 0L;
+    if (auto ms = adaptive ? adaptive->Get() : 0)
+        total = ms;
+    auto connect = total ? std::min<long>(total, long(CONNECT_TIMEOUT_MS)) : long(CONNECT_TIMEOUT_MS);
+    if (deadline != NoDeadline()) {
+        auto left = TimeLeft(deadline);
+        if (left <= 0) return false;
+        total   = total ? std::min<long>(total, left) : left;
+        connect = std::min<long>(connect, left);
+    }
+    curl_easy_setopt(h, CURLOPT_CONNECTTIMEOUT_MS, connect);
+    curl_easy_setopt(h, CURLOPT_TIMEOUT_MS,        total);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/// When and how to retry a failed request. Attempt `n` (n >= 1) is retried
+/// after `base_ms * 2^(n-1)` ms, capped at `max_ms`, of which a `jitter`
+/// fraction is randomized. A `Retry-After` response header overrides the
+/// backoff; a request asking to wait longer than `max_ms` isn't retried.
+/// Requests with a non-idempotent method (POST) are only retried when they
+/// carry an idempotency key header, as the server may have acted on them.
+//------------------------------------------------------------------------------
+struct RetryPolicy
+{
+    RetryPolicy()
+        : max_attempts(1)
+        , base_ms(100)
+        , max_ms(10000)
+        , jitter(0.5)
+        , retry_on(DefaultRetryOn())
+        , idempotency_header("Idempotency-Key")
+    {}
+
+    int                 max_attempts;   ///< Including the first one
+    long                base_ms;
+    long                max_ms;
+    double              jitter;         ///< 0..1
+    std::vector<int>    retry_on;       ///< CURLcodes (< 100) and HTTP statuses
+    std::string         idempotency_header;
+
+    /// Transport errors and HTTP statuses that are usually transient
+    static std::vector<int> DefaultRetryOn()
+    {
+        return {CURLE_COULDNT_RESOLVE_HOST, CURLE_COULDNT_CONNECT, CURLE_OPERATION_TIMEDOUT,
+                CURLE_SSL_CONNECT_ERROR, CURLE_GOT_NOTHING, CURLE_SEND_ERROR, CURLE_RECV_ERROR,
+                408, 429, 500, 502, 503, 504};
+    }
+
+    /// Parse a comma separated list of codes, or nullptr/"" for the defaults
+    static std::vector<int> ParseRetryOn(const char* codes)
+    {
+        if (!codes || !*codes) return DefaultRetryOn();
+        std::vector<int> res;
+        for (auto& s : split(codes, ','))
+            if (!s.empty()) res.push_back(atoi(s.c_str()));
+        return res;
+    }
+
+    bool Retryable(int res, long status) const
+    {
+        auto code = res != CURLE_OK ? res : int(status);
+        return std::find(retry_on.begin(), retry_on.end(), code) != retry_on.end();
+    }
+
+    bool Idempotent(int method, const std::vector<std::string>& headers) const
+    {
+        if (method == CurlMethod::GET || method == CurlMethod::PUT || method == CurlMethod::DEL)
+            return true;
+        for (auto& h : headers)
+            if (HasName(h, idempotency_header))
+                return true;
+        return false;
+    }
+
+    template <class Rng>
+    long Backoff(int attempt, Rng& rng) const
+    {
+        auto d = double(base_ms);
+        for (int i = 1; i < attempt && d < max_ms; ++i) d *= 2;
+        d = std::min<double>(d, double(max_ms));
+        auto j = std::min<double>(std::max<double>(jitter, 0.0), 1.0);
+        return long(d * (1 - j) + std::uniform_real_distribution<double>(0, d * j)(rng));
+    }
+
+    /// Case-insensitive check that header line `h` is "`name`: ..."
+    static bool HasName(const std::string& h, const std::string& name)
+    {
+        if (name.empty() || h.size() <= name.size() || h[name.size()] != ':')
+            return false;
+        for (size_t i = 0; i < name.size(); ++i)
+            if (tolower(uint8_t(h[i])) != tolower(uint8_t(name[i])))
+                return false;
+        return true;
+    }
+};
+
+//------------------------------------------------------------------------------
+/// A request executed on the engine with its own easy handle, so that the
+/// caller only collects the result. Failed attempts are retried according
+/// to the `RetryPolicy` after a delay spent on the engine's timer queue.
+/// Each attempt's latency is recorded in the host and endpoint histograms,
+/// and its outcome in the host's circuit breaker and in the statistics of
+/// the mirror the request is routed to. An attempt refused by an
+/// open breaker fails with ERR_CIRCUIT_OPEN. Retries are queued behind the
+/// rate limits of the URL like the first attempt (see `RateLimits`).
+///
+/// A GET request may be hedged: if an attempt hasn't completed after the
+/// hedge delay, an identical transfer is started (on a pooled or a new
+/// connection), and whichever of the two completes first is the outcome of
+/// the attempt while the other one is aborted.
+///
+/// A request leading a `Flight` lands it with its final response, shared by
+/// the identical requests that joined it.
+///
+/// No attempt runs past the request's deadline, nor is one retried after it.
+/// Cancelling the request's ticket aborts its transfers, and it finishes
+/// with CURLE_ABORTED_BY_CALLBACK.
+//------------------------------------------------------------------------------
+class Request : public Engine::Job, public std::enable_shared_from_this<Request>
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// `Spec::hedge_ms` to hedge after the host's running p95 latency
+    static const long     HEDGE_P95         = -1;
+    /// Latencies recorded for a host before its p95 is used
+    static const uint64_t HEDGE_MIN_SAMPLES = 20;
+
+    struct Spec {
+        std::string              url;
+        std::vector<std::string> headers;
+        int                      method;
+        unsigned                 opts;
+        bool                     has_body;
+        std::string              body;
+        int                      timeout_secs;
+        RetryPolicy              retry;
+        long                     hedge_ms;  ///< 0 - don't hedge, > 0 - delay, or HEDGE_P95
+        int                      priority;  ///< Engine::Job::Class
+        std::string              host;      ///< Whose connection slots the transfers take
+        LatencyHistogram*        host_stats;
+        LatencyHistogram*        endpoint_stats;
+        CircuitBreaker*          breaker;
+        AdaptiveTimeout*         timeouts;
+        Mirror*                  mirror;    ///< The URL is routed to
+        std::string              flight_key;
+        SingleFlight::FlightPtr  flight;    ///< Led by this request, landed (or abandoned) when it finishes
+        Deadline                 deadline;
+        CancelToken::Ticket      cancel;
+    };
+
+    struct Result {
+        int                      res;
+        long                     status;
+        std::string              body;
+        std::vector<std::string> headers;   ///< Response headers of the last attempt
+        int                      attempts;
+        uint64_t                 usec;      ///< Time from submission to completion
+    };
+
+    explicit Request(Spec&& spec)
+        : m_spec(std::move(spec))
+        , m_done(false)
+        , m_transferred(false)
+        , m_submitted(Clock::now())
+    {
+        m_err[0]          = '\0';
+        m_result.res      = CURLE_ABORTED_BY_CALLBACK;  // Until an attempt completes
+        m_result.status   = 0;
+        m_result.attempts = 0;
+        m_result.usec     = 0;
+    }
+
+    CURL* Start() override
+    {
+        if (m_spec.cancel.Cancelled())
+            return Fail(CURLE_ABORTED_BY_CALLBACK, "Request cancelled");
+        if (TimeLeft(m_spec.deadline) <= 0)
+            return Fail(CURLE_OPERATION_TIMEDOUT, "Request deadline exceeded");
+        auto h = Setup(m_main);
+        if (!h) {
+            m_result.res  = TimeLeft(m_spec.deadline) ? CURLE_FAILED_INIT : CURLE_OPERATION_TIMEDOUT;
+            m_transferred = false;
+            return nullptr;
+        }
+        if (m_spec.breaker && !m_spec.breaker->Allow())
+            return Fail(ERR_CIRCUIT_OPEN, ("Circuit breaker open for " + m_spec.url).c_str());
+        ++m_result.attempts;
+
+        auto delay = HedgeDelay();
+        if (delay > 0) {
+            m_hedge = std::make_shared<Hedge>(shared_from_this());
+            Engine::Instance().Reschedule(m_hedge, delay);
+        }
+        return h;
+    }
+
+    long Done(CURLcode res) override
+    {
+        CancelHedge();
+        return Complete(m_main, res);
+    }
+
+    int                Priority() const override { return m_spec.priority; }
+    const std::string& SlotHost() const override { return m_spec.host;     }
+
+    void Finished() override
+    {
+        CancelHedge();
+        if (m_spec.cancel.Cancelled() && m_result.res != CURLE_ABORTED_BY_CALLBACK)
+            Fail(CURLE_ABORTED_BY_CALLBACK, "Request cancelled");   // While waiting to be retried
+        if (m_spec.flight) {
+            if (m_transferred && ServerOutcome(m_result.res, m_spec.deadline)) {
+                Flight::Response r{m_result.res, m_result.status, m_result.body, m_result.headers, m_err};
+                SingleFlight::Instance().Land(m_spec.flight_key, m_spec.flight, std::move(r));
+            } else
+                SingleFlight::Instance().Abandon(m_spec.flight_key, m_spec.flight);
+            m_spec.flight.reset();
+        }
+        m_result.usec = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                            Clock::now() - m_submitted).count());
+        m_done.store(true, std::memory_order_release);
+    }
+
+    /// Caller side: the request completed (or was cancelled)
+    bool        Ready() const { return m_done.load(std::memory_order_acquire); }
+    /// Caller side: the result, once `Ready()`
+    Result&     Get()         { return m_result; }
+    const char* Error() const { return m_err;    }
+
+private:
+    /// A transfer of an attempt: the request's own, or a hedged one
+    struct Transfer {
+        Transfer() : easy(nullptr), list(nullptr) { err[0] = '\0'; }
+        ~Transfer()
+        {
+            if (list) curl_slist_free_all(list);
+            if (easy) curl_easy_cleanup(easy);
+        }
+
+        CURL*                    easy;
+        struct curl_slist*       list;
+        std::string              body;
+        std::vector<std::string> headers;
+        Clock::time_point        start;
+        char                     err[CURL_ERROR_SIZE];
+    };
+
+    /// The hedged transfer of the current attempt, run as a job of its own
+    class Hedge : public Engine::Job
+    {
+    public:
+        explicit Hedge(std::shared_ptr<Request>&& owner)
+            : m_owner(std::move(owner))
+            , m_priority(m_owner->Priority())
+            , m_host(m_owner->SlotHost())
+        {}
+
+        CURL* Start() override
+        {
+            return m_owner && m_owner->m_hedge.get() == this ? m_owner->StartHedge(m_transfer) : nullptr;
+        }
+
+        long Done(CURLcode res) override
+        {
+            if (m_owner) m_owner->HedgeDone(m_transfer, res);
+            return -1;
+        }
+
+        void Finished() override { m_owner.reset(); }
+
+        int                Priority() const override { return m_priority; }
+        const std::string& SlotHost() const override { return m_host;     }
+
+    private:
+        std::shared_ptr<Request> m_owner;
+        int                      m_priority;
+        std::string              m_host;
+        Transfer                 m_transfer;
+    };
+
+    /// Configure the easy handle of `t` for the request
+    CURL* Setup(Transfer& t)
+    {
+        if (!t.easy && !(t.easy = curl_easy_init()))
+            return nullptr;
+        curl_easy_reset(t.easy);
+
+        t.body.clear();
+        t.headers.clear();
+        t.err[0] = '\0';
+
+        auto h       = t.easy;
+        auto headers = m_spec.headers;
+        if (SetMethod(h, m_spec.method, m_spec.has_body ? m_spec.body.c_str() : nullptr, headers))
+            return nullptr;
+        if (t.list) curl_slist_free_all(t.list);
+        t.list = nullptr;
+        for (auto& s : headers)
+            if (!s.empty()) t.list = curl_slist_append(t.list, s.c_str());
+
+        curl_easy_setopt(h, CURLOPT_URL,            m_spec.url.c_str());
+        curl_easy_setopt(h, CURLOPT_HTTPHEADER,     t.list);
+        curl_easy_setopt(h, CURLOPT_FOLLOWLOCATION, long((OPT_FOLLOW_REDIRECTS & m_spec.opts) == OPT_FOLLOW_REDIRECTS));
+        if ((CURL_OPT_NOBODY & m_spec.opts) == CURL_OPT_NOBODY)
+            curl_easy_setopt(h, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(h, CURLOPT_WRITEFUNCTION,  OnData);
+        curl_easy_setopt(h, CURLOPT_WRITEDATA,      &t);
+        curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, OnHeader);
+        curl_easy_setopt(h, CURLOPT_HEADERDATA,     &t);
+        curl_easy_setopt(h, CURLOPT_ERRORBUFFER,    t.err);
+        curl_easy_setopt(h, CURLOPT_XFERINFOFUNCTION, CancelToken::OnProgress);
+        curl_easy_setopt(h, CURLOPT_XFERINFODATA,   &m_spec.cancel);
+        curl_easy_setopt(h, CURLOPT_NOPROGRESS,     0L);
+        if (!SetTimeouts(h, m_spec.timeout_secs, m_spec.deadline, m_spec.timeouts))
+            return nullptr;
+        curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE,  1L);
+        curl_easy_setopt(h, CURLOPT_NOSIGNAL,       1L);
+
+        t.start = Clock::now();
+        return h;
+    }
+
+    /// Fail the request without a transfer
+    CURL* Fail(int res, const char* err)
+    {
+        m_result.res    = res;
+        m_result.status = 0;
+        m_result.body.clear();
+        m_result.headers.clear();
+        m_transferred   = false;
+        snprintf(m_err, sizeof(m_err), "%s", err);
+        return nullptr;
+    }
+
+    /// Delay in ms after which to hedge the attempt, or 0 not to
+    long HedgeDelay() const
+    {
+        if (m_spec.method != CurlMethod::GET || !m_spec.hedge_ms)
+            return 0;
+        if (m_spec.hedge_ms > 0)
+            return m_spec.hedge_ms;
+        auto p95 = m_spec.host_stats ? m_spec.host_stats->Quantile(0.95, HEDGE_MIN_SAMPLES) : 0;
+        return p95 ? std::max<long>(1L, long(p95 / 1000)) : 0;
+    }
+
+    CURL* StartHedge(Transfer& t)
+    {
+        // Don't queue a hedge behind a rate limit
+        auto h = Setup(t);
+        if (!h || RateLimits::Instance().Reserve(m_spec.url.c_str(), 0) < 0)
+            return nullptr;
+        return !m_spec.breaker || m_spec.breaker->Allow() ? h : nullptr;
+    }
+
+    /// The hedged transfer completed first: it's the outcome of the attempt
+    void HedgeDone(Transfer& t, CURLcode res)
+    {
+        auto self  = shared_from_this();
+        m_hedge.reset();
+        auto delay = Complete(t, res);
+        // Abort the request's own transfer, finishing or retrying it
+        if (delay < 0) Engine::Instance().Abort(self);
+        else           Engine::Instance().Reschedule(self, delay);
+    }
+
+    void CancelHedge()
+    {
+        if (!m_hedge) return;
+        Engine::JobPtr hedge(std::move(m_hedge));
+        m_hedge.reset();
+        Engine::Instance().Abort(hedge);
+    }
+
+    /// Record the outcome of an attempt completed by transfer `t`. Returns
+    /// the delay before retrying it, or -1
+    long Complete(Transfer& t, CURLcode res)
+    {
+        long status = 0;
+        if (res == CURLE_OK)
+            curl_easy_getinfo(t.easy, CURLINFO_RESPONSE_CODE, &status);
+
+        // The attempt's latency as the caller saw it, even when the hedge won:
+        // timing the hedge alone would hide the tail that `HedgeDelay()` reads
+        auto usec = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_main.start).count());
+        auto err  = res != CURLE_OK || status >= 400;
+        if (!m_spec.cancel.Cancelled()) {   // A cancelled outcome says nothing of the server
+            if (m_spec.host_stats)     m_spec.host_stats->Record(usec, err);
+            if (m_spec.endpoint_stats) m_spec.endpoint_stats->Record(usec, err);
+            if (m_spec.breaker)        m_spec.breaker->Record(CircuitBreaker::Failure(res, status));
+            if (m_spec.mirror)         Mirrors::Instance().Record(m_spec.mirror, usec, CircuitBreaker::Failure(res, status));
+        }
+
+        m_result.res    = res;
+        m_result.status = status;
+        m_result.body.swap(t.body);
+        m_result.headers.swap(t.headers);
+        m_transferred   = true;
+        memcpy(m_err, t.err, sizeof(m_err));
+
+        auto& retry = m_spec.retry;
+        if (m_result.attempts < retry.max_attempts && retry.Retryable(res, status) &&
+            retry.Idempotent(m_spec.method, m_spec.headers) && !m_spec.cancel.Cancelled()) {
+            auto delay = RetryAfter();
+            if (delay < 0)
+                delay = retry.Backoff(m_result.attempts, Rng());
+            // A retry must start before the deadline
+            auto left  = TimeLeft(m_spec.deadline);
+            auto wait  = delay <= retry.max_ms && delay < left
+                       ? RateLimits::Instance().Reserve(m_spec.url.c_str(), left - 1,
+                                                        m_spec.priority == CRITICAL)
+                       : -1;
+            if (wait >= 0)
+                return std::max<long>(delay, wait);
+        }
+        return -1;
+    }
+
+    /// Delay in ms requested by a `Retry-After` header, or -1
+    long RetryAfter() const
+    {
+        for (auto& h : m_result.headers) {
+            if (!RetryPolicy::HasName(h, "Retry-After")) continue;
+            auto v = h.c_str() + 12;
+            while (*v == ' ') ++v;
+            if (isdigit(uint8_t(*v)))
+                return atol(v) * 1000;
+            auto t = curl_getdate(v, nullptr);  // HTTP-date
+            if (t < 0) return -1;
+            auto d = long(t - time(nullptr));
+            return d > 0 ? d * 1000 : 0;
+        }
+        return -1;
+    }
+
+    /// Backoff jitter source, seeded once per (engine) thread rather than
+    /// opening the entropy device for every request
+    static std::mt19937& Rng()
+    {
+        static thread_local std::mt19937 s_rng(std::random_device{}());
+        return s_rng;
+    }
+
+    static size_t OnData(char* p, size_t size, size_t nmemb, void* userp)
+    {
+        auto n = size * nmemb;
+        static_cast<Transfer*>(userp)->body.append(p, n);
+        return n;
+    }
+
+    static size_t OnHeader(char* p, size_t size, size_t nmemb, void* userp)
+    {
+        auto sz = size * nmemb;
+        auto n  = HeaderLength(p, sz);
+        if (n)
+            static_cast<Transfer*>(userp)->headers.emplace_back(p, n);
+        return sz;
+    }
+
+    Spec                    m_spec;
+    Transfer                m_main;     ///< The request's own transfer
+    std::shared_ptr<Hedge>  m_hedge;    ///< Hedged transfer of the current attempt
+    Result                  m_result;
+    std::atomic<bool>       m_done;
+    bool                    m_transferred;  ///< `m_result` is the outcome of a transfer
+    Clock::time_point       m_submitted;
+    char                    m_err[CURL_ERROR_SIZE];
+};
@@ -0,0 +1,281 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-sse.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Server-Sent Events (text/event-stream) client
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "curl-mt4-engine.h"
+#include "curl-mt4-queue.h"
+#include <curl/curl.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+/// A dispatched event
+//------------------------------------------------------------------------------
+struct StreamEvent
+{
+    std::string type;
+    std::string data;
+    std::string id;
+};
+
+//------------------------------------------------------------------------------
+/// Incremental parser of the event stream format. Input may be split at any
+/// byte: an incomplete line is carried over to the next `Feed()`. Lines end
+/// with CRLF, LF or CR, and an empty line dispatches the event accumulated
+/// from the preceding `event:`, `data:` and `id:` fields.
+//------------------------------------------------------------------------------
+class SseParser
+{
+public:
+    SseParser() : m_retry(-1), m_bom(true), m_cr(false) {}
+
+    /// Start a new connection: drop partial input, keep the last event ID
+    void Reset()
+    {
+        m_line.clear();
+        m_event.type.clear();
+        m_event.data.clear();
+        m_bom = true;
+        m_cr  = false;
+    }
+
+    const std::string& LastId() const { return m_last_id; }
+    /// Reconnection delay in ms requested by the server, or -1
+    long               Retry()  const { return m_retry;   }
+
+    /// Parse `n` bytes calling `f(StreamEvent&)` for every complete event
+    template <class F>
+    void Feed(const char* p, size_t n, F&& f)
+    {
+        auto end = p + n;
+        while (p < end) {
+            if (m_cr && *p == '\n') { ++p; m_cr = false; continue; }
+            m_cr = false;
+            auto e = p;
+            while (e < end && *e != '\n' && *e != '\r') ++e;
+            if (e == end) {
+                m_line.append(p, e);
+                break;
+            }
+            m_cr = *e == '\r';
+            if (m_line.empty())
+                Line(p, size_t(e - p), f);
+            else {
+                m_line.append(p, e);
+                Line(m_line.c_str(), m_line.size(), f);
+                m_line.clear();
+            }
+            p = e + 1;
+        }
+    }
+
+private:
+    template <class F>
+    void Line(const char* s, size_t n, F& f)
+    {
+        if (m_bom) {                // The stream may start with a UTF-8 BOM
+            m_bom = false;
+            if (n >= 3 && memcmp(s, "\xEF\xBB\xBF", 3) == 0) { s += 3; n -= 3; }
+        }
+        if (!n) {
+            Dispatch(f);
+            return;
+        }
+        if (*s == ':') return;      // Comment
+
+        auto colon = static_cast<const char*>(memchr(s, ':', n));
+        auto name  = std::string(s, colon ? colon : s + n);
+        auto value = colon ? colon + 1 : s + n;
+        auto vlen  = size_t(s + n - value);
+        if (vlen && *value == ' ') { ++value; --vlen; }
+
+        if (name == "data") {
+            m_event.data.append(value, vlen);
+            m_event.data.push_back('\n');
+        } else if (name == "event")
+            m_event.type.assign(value, vlen);
+        else if (name == "id") {
+            if (!memchr(value, '\0', vlen))
+                m_last_id.assign(value, vlen);
+        } else if (name == "retry") {
+            long v = 0;
+            for (size_t i = 0; i < vlen; ++i) {
+                if (value[i] < '0' || value[i] > '9') return;
+                v = v * 10 + (value[i] - '0');
+            }
+            if (vlen) m_retry = v;
+        }
+    }
+
+    template <class F>
+    void Dispatch(F& f)
+    {
+        if (m_event.data.empty()) {
+            m_event.type.clear();
+            return;
+        }
+        m_event.data.pop_back();    // Trailing LF
+        if (m_event.type.empty())
+            m_event.type = "message";
+        m_event.id = m_last_id;
+        f(m_event);
+        m_event.type.clear();
+        m_event.data.clear();
+    }
+
+    std::string m_line;     ///< Incomplete line carried over between chunks
+    StreamEvent m_event;    ///< Event being accumulated
+    std::string m_last_id;
+    long        m_retry;
+    bool        m_bom;      ///< Next line is the first of the stream
+    bool        m_cr;       ///< Last line ended with CR (skip a following LF)
+};
+
+//------------------------------------------------------------------------------
+/// An event stream connection kept open by the engine. The response is
+/// parsed as it arrives and complete events are queued for the handle's
+/// owner. When the connection ends it's reopened after the delay requested
+/// by the server (default 3s) with the `Last-Event-ID` header; a failed
+/// connection (transport error, 408, 429 or 5xx) backs off exponentially
+/// from that delay. The stream is closed for good when the server answers
+/// 204 No Content, another 4xx, or a response that isn't text/event-stream.
+//------------------------------------------------------------------------------
+class EventStream : public Engine::Job
+{
+public:
+    static const size_t QUEUE_SIZE       = 4096;
+    static const long   DEFAULT_RETRY_MS = 3000;
+    static const long   MAX_BACKOFF_MS   = 60000;
+
+    EventStream(const std::string& url, const std::vector<std::string>& headers)
+        : m_url(url)
+        , m_headers(headers)
+        , m_easy(nullptr)
+        , m_list(nullptr)
+        , m_queue(QUEUE_SIZE)
+        , m_status(0)
+        , m_backoff(0)
+        , m_last_status(0)
+        , m_closed(false)
+        , m_connects(0)
+    {
+        m_err[0] = '\0';
+    }
+
+    ~EventStream()
+    {
+        if (m_list) curl_slist_free_all(m_list);
+        if (m_easy) curl_easy_cleanup(m_easy);
+    }
+
+    CURL* Start() override
+    {
+        if (!m_easy && !(m_easy = curl_easy_init()))
+            return nullptr;
+        curl_easy_reset(m_easy);
+
+        if (m_list) curl_slist_free_all(m_list);
+        m_list = nullptr;
+        for (auto& h : m_headers)
+            if (!h.empty()) m_list = curl_slist_append(m_list, h.c_str());
+        m_list = curl_slist_append(m_list, "Accept: text/event-stream");
+        m_list = curl_slist_append(m_list, "Cache-Control: no-cache");
+        if (!m_parser.LastId().empty())
+            m_list = curl_slist_append(m_list, ("Last-Event-ID: " + m_parser.LastId()).c_str());
+
+        m_parser.Reset();
+        m_status = 0;
+        m_err[0] = '\0';
+
+        curl_easy_setopt(m_easy, CURLOPT_URL,            m_url.c_str());
+        curl_easy_setopt(m_easy, CURLOPT_HTTPHEADER,     m_list);
+        curl_easy_setopt(m_easy, CURLOPT_WRITEFUNCTION,  OnData);
+        curl_easy_setopt(m_easy, CURLOPT_WRITEDATA,      this);
+        curl_easy_setopt(m_easy, CURLOPT_ERRORBUFFER,    m_err);
+        curl_easy_setopt(m_easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(m_easy, CURLOPT_CONNECTTIMEOUT, 7L);
+        curl_easy_setopt(m_easy, CURLOPT_TCP_KEEPALIVE,  1L);
+        curl_easy_setopt(m_easy, CURLOPT_NOSIGNAL,       1L);
+        ++m_connects;
+        return m_easy;
+    }
+
+    long Done(CURLcode res) override
+    {
+        long status = 0;
+        curl_easy_getinfo(m_easy, CURLINFO_RESPONSE_CODE, &status);
+        if (status)
+            m_last_status.store(status);
+
+        if (status == 204 || (status / 100 == 4 && status != 408 && status != 429))
+            return -1;
+        if (status == 200 && !IsEventStream())
+            return -1;              // Retrying won't turn it into a stream
+        auto retry = m_parser.Retry();
+        auto delay = retry >= 0 ? retry : DEFAULT_RETRY_MS;
+        if (res == CURLE_OK && status == 200) {
+            m_backoff = 0;          // The stream ended normally
+            return delay;
+        }
+        m_backoff = m_backoff ? std::min<long>(m_backoff * 2, long(MAX_BACKOFF_MS)) : delay;
+        return m_backoff;
+    }
+
+    void Finished() override { m_closed.store(true); }
+
+    /// Consumer side, see `CurlNextEvent()`
+    SpscQueue<StreamEvent>& Queue()        { return m_queue;           }
+    bool                    Closed() const { return m_closed.load();   }
+    int                     Connects() const { return m_connects.load(); }
+    /// HTTP status of the last response, 0 if none was received yet
+    long                    Status() const { return m_last_status.load(); }
+
+private:
+    bool IsEventStream() const
+    {
+        const char* type = nullptr;
+        curl_easy_getinfo(m_easy, CURLINFO_CONTENT_TYPE, &type);
+        static const char s_type[] = "text/event-stream";
+        if (!type) return false;
+        for (size_t i = 0; i < sizeof(s_type)-1; ++i)
+            if (tolower(uint8_t(type[i])) != s_type[i]) return false;
+        auto c = type[sizeof(s_type)-1];
+        return c == '\0' || c == ';' || c == ' ';
+    }
+
+    static size_t OnData(char* p, size_t size, size_t nmemb, void* userp)
+    {
+        auto self = static_cast<EventStream*>(userp);
+        auto n    = size * nmemb;
+        if (!self->m_status) {
+            curl_easy_getinfo(self->m_easy, CURLINFO_RESPONSE_CODE, &self->m_status);
+            if (self->m_status == 200 && !self->IsEventStream())
+                return 0;           // Abort the transfer, `Done()` closes the stream
+        }
+        if (self->m_status != 200)
+            return n;               // Error page, not an event stream
+        self->m_parser.Feed(p, n, [self](StreamEvent& ev) { self->m_queue.Push(ev); });
+        return n;
+    }
+
+    std::string              m_url;
+    std::vector<std::string> m_headers;
+    CURL*                    m_easy;
+    struct curl_slist*       m_list;
+    SseParser                m_parser;
+    SpscQueue<StreamEvent>   m_queue;
+    long                     m_status;
+    long                     m_backoff;     ///< Last failure's reconnection delay
+    std::atomic<long>        m_last_status;
+    std::atomic<bool>        m_closed;
+    std::atomic<int>         m_connects;
+    char                     m_err[CURL_ERROR_SIZE];
+};
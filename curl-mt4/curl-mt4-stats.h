@@ -0,0 +1,247 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-stats.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Process-wide request latency histograms keyed by host/endpoint
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+/// HDR-style log-linear histogram of latencies in microseconds.
+/// Values below `SUB` are recorded exactly, larger values land in one of
+/// `SUB/2` linear sub-buckets of their power of two (~3% relative error).
+/// Counters are sharded per thread so that concurrent `Record()` calls
+/// never contend on a lock or on the same cache line.
+//------------------------------------------------------------------------------
+class LatencyHistogram
+{
+public:
+    static const int      SUB_BITS = 6;
+    static const int      SUB      = 1 << SUB_BITS;
+    static const int      MAX_BITS = 38;    // ~76 hours in usec
+    static const int      BUCKETS  = SUB + (MAX_BITS - SUB_BITS) * (SUB / 2);
+    static const int      SHARDS   = 8;
+
+    struct Summary {
+        uint64_t count, errors, p50, p90, p99, p999, max;
+    };
+
+    LatencyHistogram() { Reset(); }
+
+    void Record(uint64_t usec, bool error)
+    {
+        auto& s = m_shards[ShardIndex()];
+        s.counts[Index(usec)].fetch_add(1, std::memory_order_relaxed);
+        if (error)
+            s.errors.fetch_add(1, std::memory_order_relaxed);
+        auto m = s.max.load(std::memory_order_relaxed);
+        while (usec > m && !s.max.compare_exchange_weak(m, usec, std::memory_order_relaxed));
+    }
+
+    void Reset()
+    {
+        for (auto& s : m_shards) {
+            for (auto& c : s.counts) c.store(0, std::memory_order_relaxed);
+            s.errors.store(0, std::memory_order_relaxed);
+            s.max.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Summary Summarize() const
+    {
+        Summary res{};
+        std::vector<uint64_t> counts(BUCKETS);
+        Merge(counts, res);
+        if (!res.count) return res;
+
+        res.p50  = Percentile(counts, res.count, 0.5,   res.max);
+        res.p90  = Percentile(counts, res.count, 0.9,   res.max);
+        res.p99  = Percentile(counts, res.count, 0.99,  res.max);
+        res.p999 = Percentile(counts, res.count, 0.999, res.max);
+        return res;
+    }
+
+    /// Return the `pct` (0..1) percentile, or 0 if fewer than `min_count`
+    /// values were recorded
+    uint64_t Quantile(double pct, uint64_t min_count = 1) const
+    {
+        Summary res{};
+        std::vector<uint64_t> counts(BUCKETS);
+        Merge(counts, res);
+        if (!res.count || res.count < min_count) return 0;
+        return Percentile(counts, res.count, pct, res.max);
+    }
+
+    /// Bucket counts summed over the shards
+    std::vector<uint64_t> Counts() const
+    {
+        Summary res{};
+        std::vector<uint64_t> counts(BUCKETS);
+        Merge(counts, res);
+        return counts;
+    }
+
+    /// Return the `pct` (0..1) percentile of bucket `counts` (e.g. of the
+    /// values recorded between two `Counts()`), or 0 if fewer than
+    /// `min_count` values were recorded
+    static uint64_t Quantile(const std::vector<uint64_t>& counts, double pct, uint64_t min_count)
+    {
+        uint64_t total = 0;
+        for (auto c : counts) total += c;
+        if (!total || total < min_count) return 0;
+        return Percentile(counts, total, pct, UINT64_MAX);
+    }
+
+    /// Map a value to its bucket index
+    static int Index(uint64_t v)
+    {
+        if (v < uint64_t(SUB)) return int(v);
+        int msb = MsbIndex(v);
+        if (msb >= MAX_BITS) return BUCKETS - 1;
+        int shift = msb - SUB_BITS + 1;
+        int mant  = int(v >> shift) - SUB / 2;
+        return SUB + (shift - 1) * (SUB / 2) + mant;
+    }
+
+    /// Highest value that maps to bucket `i`
+    static uint64_t UpperBound(int i)
+    {
+        if (i < SUB) return uint64_t(i);
+        int      k     = i - SUB;
+        int      shift = k / (SUB / 2) + 1;
+        uint64_t mant  = uint64_t(k % (SUB / 2) + SUB / 2);
+        return ((mant + 1) << shift) - 1;
+    }
+
+private:
+    struct Shard {
+        std::atomic<uint32_t> counts[BUCKETS];
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> max;
+        char                  pad[64];  // keep shards off each other's cache lines
+    };
+
+    /// Sum the shards into `counts`, setting the count, errors and max of `res`
+    void Merge(std::vector<uint64_t>& counts, Summary& res) const
+    {
+        for (auto& s : m_shards) {
+            for (int i = 0; i < BUCKETS; ++i)
+                counts[i] += s.counts[i].load(std::memory_order_relaxed);
+            res.errors += s.errors.load(std::memory_order_relaxed);
+            res.max     = std::max<uint64_t>(res.max, s.max.load(std::memory_order_relaxed));
+        }
+        for (auto c : counts) res.count += c;
+    }
+
+    static int MsbIndex(uint64_t v)
+    {
+        int n = 0;
+        while (v >>= 1) ++n;
+        return n;
+    }
+
+    static int ShardIndex()
+    {
+        static std::atomic<unsigned> s_next{0};
+        static thread_local unsigned s_shard = s_next.fetch_add(1) % SHARDS;
+        return int(s_shard);
+    }
+
+    static uint64_t Percentile(const std::vector<uint64_t>& counts, uint64_t total,
+                               double pct, uint64_t max)
+    {
+        auto     rank = uint64_t(pct * double(total) + 0.5);
+        uint64_t seen = 0;
+        if (!rank) rank = 1;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min<uint64_t>(UpperBound(i), max);
+        }
+        return max;
+    }
+
+    Shard m_shards[SHARDS];
+};
+
+//------------------------------------------------------------------------------
+/// Registry of latency histograms keyed by host and by caller-supplied
+/// endpoint tag. Histograms are never deleted, so the pointers handed out
+/// by `Get()` may be cached by the caller for the lifetime of the process.
+//------------------------------------------------------------------------------
+class LatencyStats
+{
+public:
+    enum Kind { HOST, ENDPOINT };
+
+    static LatencyStats& Instance()
+    {
+        static LatencyStats s_instance;
+        return s_instance;
+    }
+
+    LatencyHistogram* Get(Kind kind, const std::string& key)
+    {
+        if (key.empty()) return nullptr;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto& h = m_hist[std::make_pair(kind, key)];
+        if (!h) h.reset(new LatencyHistogram());
+        return h.get();
+    }
+
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (auto& kv : m_hist) kv.second->Reset();
+    }
+
+    /// Format a CSV snapshot of all histograms (latencies in usec)
+    std::string Snapshot() const
+    {
+        std::string out("type,key,count,errors,p50,p90,p99,p99.9,max\n");
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (auto& kv : m_hist) {
+            auto s = kv.second->Summarize();
+            char buf[160];
+            snprintf(buf, sizeof(buf), ",%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                     (unsigned long long)s.count, (unsigned long long)s.errors,
+                     (unsigned long long)s.p50,   (unsigned long long)s.p90,
+                     (unsigned long long)s.p99,   (unsigned long long)s.p999,
+                     (unsigned long long)s.max);
+            out += kv.first.first == HOST ? "host," : "endpoint,";
+            out += kv.first.second;
+            out += buf;
+        }
+        return out;
+    }
+
+    /// Extract the host[:port] part of a URL
+    static std::string Host(const char* url)
+    {
+        if (!url) return std::string();
+        auto p = strstr(url, "://");
+        p = p ? p + 3 : url;
+        auto at = p;
+        for (; *at && *at != '/' && *at != '?' && *at != '#'; ++at)
+            if (*at == '@') p = at + 1;     // skip user:password@
+        return std::string(p, at);
+    }
+
+private:
+    LatencyStats() = default;
+
+    mutable std::mutex m_mtx;
+    std::map<std::pair<Kind, std::string>, std::unique_ptr<LatencyHistogram>> m_hist;
+};
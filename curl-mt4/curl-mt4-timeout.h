@@ -0,0 +1,165 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-timeout.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Process-wide per-host request timeouts adapted to latency
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "curl-mt4-stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+/// Timeout of requests to a host derived from the host's latency histogram:
+/// `multiplier` times the p99 latency of the last minute or so, clamped to
+/// [`floor_ms`, `ceiling_ms`]. The timeout is recomputed every second from
+/// the difference between the histogram and a snapshot taken up to a minute
+/// ago, so it widens as soon as the host slows down (requests timing out
+/// count at the timeout) and tightens again once it recovers. Until enough
+/// latencies are recorded there's no adaptive timeout. A `multiplier` <= 0
+/// disables the policy.
+//------------------------------------------------------------------------------
+class AdaptiveTimeout
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static const long     REFRESH_MS  = 1000;
+    static const long     SNAPSHOT_MS = 10000;
+    static const size_t   SNAPSHOTS   = 6;      ///< The window spans 50..60s
+    static const uint64_t MIN_SAMPLES = 20;
+
+    struct Config {
+        double multiplier;
+        long   floor_ms;
+        long   ceiling_ms;
+    };
+
+    AdaptiveTimeout(const LatencyHistogram* hist, const Config& cfg)
+        : m_hist(hist), m_cfg(cfg), m_own_cfg(false), m_timeout(0)
+    {}
+
+    /// Set the configuration. A host's own configuration isn't replaced by
+    /// the default one
+    void Configure(const Config& cfg, bool own)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!own && m_own_cfg) return;
+        m_cfg     = cfg;
+        m_own_cfg = own;
+        m_refresh = Clock::time_point();    // Apply at the next request
+    }
+
+    /// Total timeout in ms of a request to the host, or 0 if there's none
+    long Get()
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_cfg.multiplier <= 0 || !m_hist)
+            return 0;
+        auto now = Clock::now();
+        if (now >= m_refresh)
+            Refresh(now);
+        return m_timeout;
+    }
+
+private:
+    void Refresh(Clock::time_point now)
+    {
+        auto counts = m_hist->Counts();
+        auto recent = counts;
+        if (!m_snapshots.empty()) {
+            auto& old = m_snapshots.front();
+            for (size_t i = 0; i < recent.size(); ++i) {
+                if (recent[i] < old[i]) {   // The histogram was reset
+                    m_snapshots.clear();
+                    recent = counts;
+                    break;
+                }
+                recent[i] -= old[i];
+            }
+        }
+        // Fall back to all latencies recorded if the host was quiet lately
+        auto p99 = LatencyHistogram::Quantile(recent, 0.99, MIN_SAMPLES);
+        if (!p99)
+            p99 = LatencyHistogram::Quantile(counts, 0.99, MIN_SAMPLES);
+        m_timeout = p99
+                  ? std::min<long>(std::max<long>(long(std::ceil(double(p99) / 1000 * m_cfg.multiplier)), m_cfg.floor_ms),
+                             std::max<long>(m_cfg.ceiling_ms, m_cfg.floor_ms))
+                  : 0;
+
+        if (m_snapshots.empty() || now >= m_snapshot) {
+            m_snapshots.push_back(std::move(counts));
+            if (m_snapshots.size() > SNAPSHOTS)
+                m_snapshots.pop_front();
+            m_snapshot = now + std::chrono::milliseconds(long(SNAPSHOT_MS));
+        }
+        m_refresh = now + std::chrono::milliseconds(long(REFRESH_MS));
+    }
+
+    std::mutex                          m_mtx;
+    const LatencyHistogram*             m_hist;
+    Config                              m_cfg;
+    bool                                m_own_cfg;  ///< Configured for this host
+    long                                m_timeout;  ///< Current timeout in ms, or 0
+    Clock::time_point                   m_refresh;  ///< When to recompute the timeout
+    Clock::time_point                   m_snapshot; ///< When to take the next snapshot
+    std::deque<std::vector<uint64_t>>   m_snapshots;///< Oldest first
+};
+
+//------------------------------------------------------------------------------
+/// Registry of adaptive timeouts keyed by host. Like circuit breakers, they
+/// are never deleted and are disabled until configured.
+//------------------------------------------------------------------------------
+class AdaptiveTimeouts
+{
+public:
+    static AdaptiveTimeouts& Instance()
+    {
+        static AdaptiveTimeouts s_instance;
+        return s_instance;
+    }
+
+    AdaptiveTimeout* Get(const std::string& host)
+    {
+        if (host.empty()) return nullptr;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return Find(host);
+    }
+
+    /// Configure the timeouts of `host`, or the default of all hosts not
+    /// configured individually if `host` is empty
+    void Configure(const std::string& host, const AdaptiveTimeout::Config& cfg)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!host.empty()) {
+            Find(host)->Configure(cfg, true);
+            return;
+        }
+        m_default = cfg;
+        for (auto& kv : m_timeouts)
+            kv.second->Configure(cfg, false);
+    }
+
+private:
+    AdaptiveTimeouts() : m_default{0, 0, 0} {}
+
+    AdaptiveTimeout* Find(const std::string& host)
+    {
+        auto& t = m_timeouts[host];
+        if (!t) t.reset(new AdaptiveTimeout(LatencyStats::Instance().Get(LatencyStats::HOST, host), m_default));
+        return t.get();
+    }
+
+    std::mutex                                              m_mtx;
+    AdaptiveTimeout::Config                                 m_default;
+    std::map<std::string, std::unique_ptr<AdaptiveTimeout>> m_timeouts;
+};
@@ -0,0 +1,305 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-trace.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     Fixed-size binary ring of trace events with lazy formatting
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <curl/curl.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+//------------------------------------------------------------------------------
+/// Trace events are stored in binary form (timestamp, event type, length and
+/// an optionally capped payload) in a ring of fixed capacity. When the ring is
+/// full, oldest events are evicted. Nothing is formatted on the request path:
+/// text is produced only when the trace is read by the caller.
+/// Every event gets a sequence number, which lets a reader incrementally
+/// drain new events using a cursor (see `Drain()`).
+//------------------------------------------------------------------------------
+class TraceRing
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+    struct Event {
+        uint64_t time_us;   ///< Wall clock time in usec since epoch
+        uint32_t len;       ///< Original length of the traced data
+        uint32_t stored;    ///< Number of payload bytes kept in the ring
+        uint32_t type;      ///< curl_infotype
+    };
+
+    explicit TraceRing(size_t capacity = DEFAULT_CAPACITY)
+        : m_buf(std::max<size_t>(capacity, sizeof(Event) + 1))
+        , m_head(0)
+        , m_tail(0)
+        , m_used(0)
+        , m_generation(0)
+        , m_first_seq(0)
+        , m_next_seq(0)
+    {}
+
+    size_t   Capacity()   const { std::lock_guard<std::mutex> g(m_mtx); return m_buf.size(); }
+    uint64_t Generation() const { std::lock_guard<std::mutex> g(m_mtx); return m_generation; }
+
+    void Capacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> g(m_mtx);
+        m_buf.assign(std::max<size_t>(capacity, sizeof(Event) + 1), 0);
+        m_head = m_tail = m_used = 0;
+        m_first_seq = m_next_seq;
+        ++m_generation;
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> g(m_mtx);
+        m_head = m_tail = m_used = 0;
+        m_first_seq = m_next_seq;
+        ++m_generation;
+    }
+
+    /// Append an event keeping at most `keep` bytes of its payload
+    void Push(curl_infotype type, const char* data, size_t len, size_t keep)
+    {
+        using namespace std::chrono;
+        Event ev;
+        ev.time_us = uint64_t(duration_cast<microseconds>(
+                         system_clock::now().time_since_epoch()).count());
+        ev.len     = uint32_t(len);
+        ev.type    = uint32_t(type);
+
+        std::lock_guard<std::mutex> g(m_mtx);
+        ev.stored  = uint32_t(std::min<size_t>(std::min<size_t>(len, keep), m_buf.size() - sizeof(Event)));
+        auto need  = sizeof(Event) + ev.stored;
+        while (m_buf.size() - m_used < need)
+            Evict();
+        Write(reinterpret_cast<const char*>(&ev), sizeof(ev));
+        Write(data, ev.stored);
+        ++m_next_seq;
+        ++m_generation;
+    }
+
+    /// Call `f(const Event&, const char* payload)` for every event, oldest first
+    template <class F>
+    void ForEach(F&& f) const
+    {
+        std::lock_guard<std::mutex> g(m_mtx);
+        std::vector<char> scratch;
+        auto pos  = m_tail;
+        auto left = m_used;
+        while (left) {
+            Event ev;
+            auto payload = Peek(pos, ev, scratch);
+            f(ev, payload);
+            pos   = (pos + sizeof(ev) + ev.stored) % m_buf.size();
+            left -= sizeof(ev) + ev.stored;
+        }
+    }
+
+    /// Format events starting at sequence number `from` into `out`, stopping
+    /// before `out` would exceed `max` bytes (an event that alone is longer
+    /// than `max` is truncated). Formatted events, as well as the ones before
+    /// `from`, are removed from the ring. Returns the sequence number of the
+    /// next event to read.
+    uint32_t Drain(uint32_t from, std::string& out, size_t max, bool hex)
+    {
+        std::lock_guard<std::mutex> g(m_mtx);
+
+        auto behind = int32_t(from - m_first_seq);
+        if (behind < 0) {
+            char buf[64];
+            int  n = snprintf(buf, sizeof(buf), "... (%u events dropped)\n", unsigned(-behind));
+            if (size_t(n) <= max) out.append(buf, n);
+            from = m_first_seq;
+        } else if (int32_t(m_next_seq - from) < 0)
+            from = m_first_seq;         // Cursor is from a different ring
+
+        while (m_first_seq != from)
+            Evict();
+
+        std::vector<char> scratch;
+        std::string       text;
+        auto              start = m_first_seq;
+
+        while (m_used && out.size() < max) {
+            Event ev;
+            auto payload = Peek(m_tail, ev, scratch);
+            text.clear();
+            FormatEvent(text, ev, payload, hex);
+            if (out.size() + text.size() > max) {
+                if (!out.empty()) break;
+                text.resize(max);
+            }
+            out += text;
+            Evict();
+        }
+
+        if (start != m_first_seq)
+            ++m_generation;
+        return m_first_seq;
+    }
+
+    /// Append human-readable text of all events to `out`
+    void Format(std::string& out, bool hex) const
+    {
+        ForEach([&out, hex](const Event& ev, const char* payload) {
+            FormatEvent(out, ev, payload, hex);
+        });
+    }
+
+    static void FormatEvent(std::string& out, const Event& ev, const char* payload, bool hex)
+    {
+        char buf[96];
+        auto secs = time_t(ev.time_us / 1000000);
+        struct tm tm;
+#ifdef _WIN32
+        gmtime_s(&tm, &secs);
+#else
+        gmtime_r(&secs, &tm);
+#endif
+        int n = snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%06u ",
+                         tm.tm_hour, tm.tm_min, tm.tm_sec, unsigned(ev.time_us % 1000000));
+        out.append(buf, n);
+
+        const char* text;
+        switch (ev.type) {
+            case CURLINFO_TEXT:
+                out.append("= Info.........: ");
+                out.append(payload, ev.stored);
+                if (ev.stored < ev.len) out.append("...\n");
+                return;
+            case CURLINFO_HEADER_OUT:   text = "> Send header.."; break;
+            case CURLINFO_DATA_OUT:     text = "> Send data...."; break;
+            case CURLINFO_SSL_DATA_OUT: text = "> Send SSL data"; break;
+            case CURLINFO_HEADER_IN:    text = "< Recv header.."; break;
+            case CURLINFO_DATA_IN:      text = "< Recv data...."; break;
+            case CURLINFO_SSL_DATA_IN:  text = "< Recv SSL data"; break;
+            default:                    text = "? Unknown......"; break;
+        }
+        n = snprintf(buf, sizeof(buf), "%s: (%u bytes)\n", text, ev.len);
+        out.append(buf, n);
+        if (!ev.stored)
+            return;
+        Dump(out, reinterpret_cast<const unsigned char*>(payload), ev.stored, !hex);
+        if (ev.stored < ev.len) {
+            n = snprintf(buf, sizeof(buf), "... (%u bytes not shown)\n", ev.len - ev.stored);
+            out.append(buf, n);
+        }
+    }
+
+    /// Append a hex/ASCII dump of `size` bytes to `out`. Each output line is
+    /// built in a local buffer using lookup tables and appended in one write.
+    /// In `nohex` mode lines are up to 120 characters wide and are also broken
+    /// at CRLF; otherwise 32 bytes are shown per line in hex and ASCII.
+    static void Dump(std::string& out, const unsigned char* ptr, size_t size, bool nohex)
+    {
+        static const char s_hex[] = "0123456789abcdef";
+        static const struct Ascii {
+            char tab[256];
+            Ascii() { for (int c = 0; c < 256; ++c) tab[c] = c >= 0x20 && c < 0x80 ? char(c) : '.'; }
+        } s_ascii;
+
+        const size_t width = nohex ? 120 : 32;
+        char line[24 + 32*3 + 120 + 1];
+
+        out.reserve(out.size() + size + size / width * (nohex ? 8 : 104) + 128);
+
+        for (size_t i = 0; i < size; ) {
+            char* p = line;
+
+            // Offset prefix: at least 4 hex digits followed by ": "
+            int digits = 4;
+            while (digits < 16 && (uint64_t(i) >> (digits * 4))) ++digits;
+            for (int d = digits - 1; d >= 0; --d)
+                *p++ = s_hex[(i >> (d * 4)) & 0xF];
+            *p++ = ':';
+            *p++ = ' ';
+
+            size_t n    = std::min<size_t>(width, size - i);
+            size_t skip = 0;
+
+            if (nohex) {
+                // Break the line at CRLF, and swallow a CRLF right after a full line
+                for (size_t c = 0; c < n; ++c)
+                    if (ptr[i+c] == 0x0D && i+c+1 < size && ptr[i+c+1] == 0x0A) {
+                        n = c; skip = 2; break;
+                    }
+                if (!skip && i+n+1 < size && ptr[i+n] == 0x0D && ptr[i+n+1] == 0x0A)
+                    skip = 2;
+            } else {
+                for (size_t c = 0; c < width; ++c, p += 3)
+                    if (c < n) {
+                        p[0] = s_hex[ptr[i+c] >> 4];
+                        p[1] = s_hex[ptr[i+c] & 0xF];
+                        p[2] = ' ';
+                    } else
+                        p[0] = p[1] = p[2] = ' ';
+            }
+
+            for (size_t c = 0; c < n; ++c)
+                *p++ = s_ascii.tab[ptr[i+c]];
+            *p++ = '\n';
+
+            out.append(line, p - line);
+            i += n + skip;
+        }
+    }
+
+private:
+    void Write(const char* p, size_t n)
+    {
+        auto first = std::min<size_t>(n, m_buf.size() - m_head);
+        memcpy(&m_buf[m_head], p, first);
+        memcpy(&m_buf[0], p + first, n - first);
+        m_head  = (m_head + n) % m_buf.size();
+        m_used += n;
+    }
+
+    void Read(size_t pos, char* p, size_t n) const
+    {
+        auto first = std::min<size_t>(n, m_buf.size() - pos);
+        memcpy(p, &m_buf[pos], first);
+        memcpy(p + first, &m_buf[0], n - first);
+    }
+
+    /// Read the event at `pos`, returning a pointer to its contiguous payload
+    const char* Peek(size_t pos, Event& ev, std::vector<char>& scratch) const
+    {
+        Read(pos, reinterpret_cast<char*>(&ev), sizeof(ev));
+        pos = (pos + sizeof(ev)) % m_buf.size();
+        if (pos + ev.stored <= m_buf.size())
+            return &m_buf[pos];
+        scratch.resize(ev.stored);
+        Read(pos, scratch.data(), ev.stored);
+        return scratch.data();
+    }
+
+    void Evict()
+    {
+        Event ev;
+        Read(m_tail, reinterpret_cast<char*>(&ev), sizeof(ev));
+        auto sz = sizeof(ev) + ev.stored;
+        m_tail  = (m_tail + sz) % m_buf.size();
+        m_used -= sz;
+        ++m_first_seq;
+    }
+
+    mutable std::mutex m_mtx;
+    std::vector<char>  m_buf;
+    size_t             m_head;  ///< Write position
+    size_t             m_tail;  ///< Position of the oldest event
+    size_t             m_used;
+    uint64_t           m_generation;
+    uint32_t           m_first_seq; ///< Sequence number of the oldest event
+    uint32_t           m_next_seq;  ///< Sequence number of the next pushed event
+};
@@ -0,0 +1,138 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-util.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     String marshaling helpers used by the exported API
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cwchar>
+
+//------------------------------------------------------------------------------
+inline int DataSize(const std::stringstream& str)
+{
+  std::stringstream& s = const_cast<std::stringstream&>(str);
+  int m = s.tellg();
+  s.seekg(0, std::ios::end);
+  int n = s.tellg();
+  s.seekg(m, std::ios::beg);
+  return n;
+}
+
+//------------------------------------------------------------------------------
+inline std::vector<std::string> split(const char *str, char c = ' ')
+{
+    std::vector<std::string> result;
+
+    do {
+        const char *begin = str;
+
+        while (*str != c && *str)
+            str++;
+
+        result.push_back(std::string(begin, str));
+    } while (*str++);
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+inline std::string wstr2str(const wchar_t* ws, int len = -1)
+{
+  return ws ? std::string(ws, ws + (len < 0 ? wcslen(ws) : len)) : std::string();
+}
+
+inline size_t str2wstr(const char* str, int size, wchar_t* out, size_t max_out_len)
+{
+#ifdef _WIN32
+  size_t n;
+  int new_len = std::min<size_t>(max_out_len, size + 1);
+  mbstowcs_s(&n, out, new_len, str, size);
+  return n - 1;
+#else
+  // Widen byte by byte, which is what mbstowcs_s() does in the "C" locale
+  if (!out) return size_t(size);
+  if (!max_out_len) return 0;
+  auto n = std::min<size_t>(max_out_len - 1, size_t(size));
+  for (size_t i = 0; i < n; ++i)
+    out[i] = wchar_t(static_cast<unsigned char>(str[i]));
+  out[n] = L'\0';
+  return n;
+#endif
+}
+
+/*
+std::string wstr2str(const wchar_t* buffer, int len = -1)
+{
+  if (!buffer) return std::string();
+  if (len < 0) len = wcslen(buffer);
+
+  int n = ::WideCharToMultiByte(CP_UTF8, 0, buffer, len, nullptr, 0, nullptr, nullptr);
+  if (n == 0) return "";
+
+  std::string newbuffer;
+  newbuffer.resize(n);
+  ::WideCharToMultiByte(CP_UTF8, 0, buffer, len,
+    const_cast<char*>(newbuffer.c_str()), n, nullptr, nullptr);
+
+  return newbuffer;
+}
+
+int write_utf8(std::string s, wchar_t* buffer, int len)
+{
+int n = ::MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, nullptr, 0);
+if (n == 0) return n;
+
+::MultiByteToWideChar(CP_UTF8, 0, s.c_str(), s.size(), buffer, 0);
+::WideCharToMultiByte(CP_UTF8, 0, buffer, len,
+const_cast<char*>(newbuffer.c_str()), n, nullptr, nullptr);
+
+return newbuffer;
+}
+
+size_t str2wstr(const char* str, size_t size, wchar_t* out, size_t max_out_size)
+{
+  if (size) {
+    int num_chars = MultiByteToWideChar(CP_ACP, MB_ERR_INVALID_CHARS, str, size, nullptr, 0);
+    if (num_chars) {
+      if (!out) return num_chars;
+      int n = std::min<size_t>(max_out_size, num_chars);
+      if (MultiByteToWideChar(CP_ACP, MB_ERR_INVALID_CHARS, str, size, out, n))
+        return n;
+    }
+  }
+  return 0;
+}
+*/
+
+inline std::wstring str2wstr(const char* str, size_t size)
+{
+  int  n = str2wstr(str, size, nullptr, 0);
+  if (!n)
+    return std::wstring();
+
+  std::wstring wstr;
+  wstr.resize(n);
+  str2wstr(str, size, &wstr[0], n);
+  return wstr;
+}
+
+//------------------------------------------------------------------------------
+/// Length of a received "Name: value" header line without its trailing CRLF,
+/// or 0 if the line is not a header (e.g. the status line)
+inline size_t HeaderLength(const char* val, size_t sz)
+{
+    auto end = val+sz;
+    auto ok  = std::find(val, end, ':');
+    if  (ok == end)
+        return 0;
+    auto p = end-1;
+    for(; p >= val && (*p == '\r' || *p == '\n'); --p);
+    return size_t(p - val + 1);
+}
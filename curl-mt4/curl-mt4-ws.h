@@ -0,0 +1,496 @@
+//------------------------------------------------------------------------------
+/// \file      curl-mt4-ws.h
+/// \author    Serge Aleynikov
+/// \copyright (c) 2018, Serge Aleynikov
+//------------------------------------------------------------------------------
+/// \brief     WebSocket (RFC 6455) client running on the background engine
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "curl-mt4-engine.h"
+#include "curl-mt4-queue.h"
+#include <curl/curl.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+/// SHA-1 digest, only used to check the handshake's `Sec-WebSocket-Accept`
+//------------------------------------------------------------------------------
+inline void Sha1(const char* data, size_t len, uint8_t out[20])
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32-n)); };
+
+    std::string m(data, len);
+    m.push_back('\x80');
+    while (m.size() % 64 != 56) m.push_back('\0');
+    for (int i = 7; i >= 0; --i) m.push_back(char(uint64_t(len) * 8 >> (i*8)));
+
+    for (size_t off = 0; off < m.size(); off += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            auto p = reinterpret_cast<const uint8_t*>(&m[off + i*4]);
+            w[i] = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+        }
+        for (int i = 16; i < 80; ++i)
+            w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if      (i < 20) { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            auto t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 20; ++i)
+        out[i] = uint8_t(h[i/4] >> (24 - (i%4)*8));
+}
+
+inline std::string Base64(const uint8_t* p, size_t n)
+{
+    static const char s_chars[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < n; i += 3) {
+        uint32_t v = uint32_t(p[i]) << 16;
+        if (i+1 < n) v |= uint32_t(p[i+1]) << 8;
+        if (i+2 < n) v |= p[i+2];
+        out.push_back(s_chars[v >> 18 & 63]);
+        out.push_back(s_chars[v >> 12 & 63]);
+        out.push_back(i+1 < n ? s_chars[v >> 6 & 63] : '=');
+        out.push_back(i+2 < n ? s_chars[v      & 63] : '=');
+    }
+    return out;
+}
+
+//------------------------------------------------------------------------------
+/// A received message
+//------------------------------------------------------------------------------
+struct WsMessage
+{
+    int         type;       ///< WebSocket::TEXT or WebSocket::BINARY
+    std::string data;
+};
+
+//------------------------------------------------------------------------------
+/// A WebSocket connection. libcurl establishes the connection (including TLS
+/// and proxy tunneling) with `CURLOPT_CONNECT_ONLY`, and the engine keeps it
+/// open, calling `Poll()` when the socket is readable. Frames are read
+/// straight into a reusable buffer, fragmented messages are reassembled and
+/// complete messages are moved into a ring for the handle's owner. Pings are
+/// answered, and the connection is pinged after `PING_MS` of silence and
+/// dropped if it stays silent for as long again.
+///
+/// Messages sent by the owner are framed and masked on the caller's thread
+/// into an output buffer that the engine writes to the socket.
+//------------------------------------------------------------------------------
+class WebSocket : public Engine::Job
+{
+    using Clock = std::chrono::steady_clock;
+
+public:
+    enum Opcode { CONTINUATION = 0, TEXT = 1, BINARY = 2, CLOSE = 8, PING = 9, PONG = 10 };
+    enum State  { CONNECTING, HANDSHAKE, OPEN, CLOSING, CLOSED };
+
+    static const size_t QUEUE_SIZE   = 4096;
+    static const size_t MAX_MESSAGE  = 16 * 1024 * 1024;
+    static const size_t READ_SIZE    = 64 * 1024;
+    static const long   PING_MS      = 30000;
+    static const long   HANDSHAKE_MS = 10000;
+    static const long   CLOSE_MS     = 1000;
+
+    WebSocket(const std::string& url, const std::vector<std::string>& headers)
+        : m_easy(nullptr)
+        , m_sock(CURL_SOCKET_BAD)
+        , m_queue(QUEUE_SIZE)
+        , m_state(CONNECTING)
+        , m_closing(false)
+        , m_rng(std::random_device()())
+        , m_out_pos(0)
+        , m_req_len(0)
+        , m_in_pos(0)
+        , m_in_len(0)
+        , m_msg_active(false)
+        , m_ping_pending(false)
+        , m_failed(false)
+    {
+        m_err[0] = '\0';
+
+        // ws://host[:port]/path -> http://host[:port]/path for libcurl to connect to
+        auto scheme = url.find("://");
+        auto rest   = scheme == std::string::npos ? url : url.substr(scheme + 3);
+        auto secure = scheme != std::string::npos &&
+                      (url.compare(0, scheme, "wss") == 0 || url.compare(0, scheme, "https") == 0);
+        auto slash  = rest.find_first_of("/?");
+        auto host   = rest.substr(0, slash);
+        auto path   = slash == std::string::npos ? "/" : rest.substr(slash);
+        if (path[0] == '?') path.insert(0, "/");
+        auto at     = host.rfind('@');
+        if  (at != std::string::npos) host.erase(0, at+1);
+        m_url = (secure ? "https://" : "http://") + rest;
+
+        uint8_t key[16];
+        for (auto& b : key) b = uint8_t(m_rng());
+        m_key = Base64(key, sizeof(key));
+
+        m_out  = "GET " + path + " HTTP/1.1\r\n"
+                 "Host: " + host + "\r\n"
+                 "Upgrade: websocket\r\n"
+                 "Connection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: " + m_key + "\r\n"
+                 "Sec-WebSocket-Version: 13\r\n";
+        for (auto& h : headers)
+            if (!h.empty()) m_out += h + "\r\n";
+        m_out += "\r\n";
+        m_req_len = m_out.size();
+    }
+
+    ~WebSocket()
+    {
+        if (m_easy) curl_easy_cleanup(m_easy);
+    }
+
+    CURL* Start() override
+    {
+        if (m_closing.load() || !(m_easy = curl_easy_init()))
+            return nullptr;
+        curl_easy_setopt(m_easy, CURLOPT_URL,            m_url.c_str());
+        curl_easy_setopt(m_easy, CURLOPT_CONNECT_ONLY,   1L);
+        curl_easy_setopt(m_easy, CURLOPT_ERRORBUFFER,    m_err);
+        curl_easy_setopt(m_easy, CURLOPT_CONNECTTIMEOUT, 7L);
+        curl_easy_setopt(m_easy, CURLOPT_TCP_NODELAY,    1L);
+        curl_easy_setopt(m_easy, CURLOPT_TCP_KEEPALIVE,  1L);
+        curl_easy_setopt(m_easy, CURLOPT_NOSIGNAL,       1L);
+        return m_easy;
+    }
+
+    long Done(CURLcode res) override
+    {
+        if (res != CURLE_OK || m_closing.load() ||
+            curl_easy_getinfo(m_easy, CURLINFO_ACTIVESOCKET, &m_sock) != CURLE_OK ||
+            m_sock == CURL_SOCKET_BAD)
+            return -1;
+        m_state.store(HANDSHAKE);
+        m_last_rx  = Clock::now();
+        return KEEP_OPEN;
+    }
+
+    void Finished() override { m_state.store(CLOSED); }
+
+    curl_socket_t Socket() override { return m_sock; }
+
+    bool Writing() override
+    {
+        std::lock_guard<std::mutex> g(m_out_mtx);
+        return m_out_pos < OutLimit();
+    }
+
+    long Poll(int) override
+    {
+        auto now = Clock::now();
+        if (m_closing.load() && m_state.load() != CLOSING) {
+            if (m_state.load() != OPEN) return -1;
+            SendClose(1000);
+        }
+
+        if (!Flush() || !Receive(now) || !Flush())
+            return -1;
+
+        switch (m_state.load()) {
+            case HANDSHAKE:
+                return Remaining(m_last_rx + std::chrono::milliseconds(long(HANDSHAKE_MS)), now);
+            case CLOSING:
+                return Remaining(m_close_at + std::chrono::milliseconds(long(CLOSE_MS)), now);
+            case OPEN:
+                break;
+            default:
+                return -1;
+        }
+
+        // Keepalive: ping a silent connection, drop it if the ping isn't answered
+        auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_last_rx).count();
+        if (idle >= 2*PING_MS)
+            return -1;
+        if (idle >= PING_MS && !m_ping_pending) {
+            m_ping_pending = true;
+            Frame(PING, nullptr, 0);
+            if (!Flush()) return -1;
+        }
+        return (m_ping_pending ? 2*PING_MS : PING_MS) - long(idle);
+    }
+
+    /// Caller side: queue a message. Returns false if the connection is closed
+    bool Send(int opcode, const char* data, size_t len)
+    {
+        if (m_closing.load() || m_state.load() >= CLOSING)
+            return false;
+        Frame(opcode, data, len);
+        return true;
+    }
+
+    /// Caller side: close the connection gracefully, see `Poll()`
+    void Close() { m_closing.store(true); }
+
+    /// Consumer side, see `CurlWsRecv()`
+    SpscQueue<WsMessage>& Queue()        { return m_queue; }
+    bool                  Closed() const { return m_state.load() == CLOSED; }
+
+private:
+    static long Remaining(Clock::time_point t, Clock::time_point now)
+    {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - now).count();
+        return ms > 0 ? long(ms) : -1;
+    }
+
+    /// Bytes of the output buffer that may be sent: frames wait for the handshake
+    size_t OutLimit() const { return m_state.load() == HANDSHAKE ? m_req_len : m_out.size(); }
+
+    /// Append a masked frame to the output buffer
+    void Frame(int opcode, const char* data, size_t len)
+    {
+        std::lock_guard<std::mutex> g(m_out_mtx);
+        m_out.push_back(char(0x80 | opcode));
+        if (len < 126)
+            m_out.push_back(char(0x80 | len));
+        else if (len < 65536) {
+            m_out.push_back(char(0x80 | 126));
+            for (int i = 1; i >= 0; --i) m_out.push_back(char(len >> (i*8)));
+        } else {
+            m_out.push_back(char(0x80 | 127));
+            for (int i = 7; i >= 0; --i) m_out.push_back(char(uint64_t(len) >> (i*8)));
+        }
+        uint8_t mask[4];
+        auto    m = uint32_t(m_rng());
+        memcpy(mask, &m, sizeof(mask));
+        m_out.append(reinterpret_cast<char*>(mask), sizeof(mask));
+        auto pos = m_out.size();
+        m_out.append(data ? data : "", data ? len : 0);
+        for (size_t i = 0; i < len; ++i)
+            m_out[pos+i] ^= mask[i & 3];
+    }
+
+    /// Send a close frame with `code` and wait for the server's one
+    void SendClose(uint16_t code)
+    {
+        char payload[2] = {char(code >> 8), char(code)};
+        Frame(CLOSE, payload, sizeof(payload));
+        m_state.store(CLOSING);
+        m_close_at = Clock::now();
+    }
+
+    /// Write as much of the output buffer as the socket takes
+    bool Flush()
+    {
+        std::lock_guard<std::mutex> g(m_out_mtx);
+        auto limit = OutLimit();
+        while (m_out_pos < limit) {
+            size_t n   = 0;
+            auto   res = curl_easy_send(m_easy, &m_out[m_out_pos], limit - m_out_pos, &n);
+            if (res == CURLE_AGAIN) break;
+            if (res != CURLE_OK)    return false;
+            m_out_pos += n;
+        }
+        if (m_out_pos == m_out.size()) {
+            m_out.clear();
+            m_out_pos = m_req_len = 0;
+        } else if (m_state.load() != HANDSHAKE && m_out_pos >= READ_SIZE) {
+            m_out.erase(0, m_out_pos);
+            m_out_pos = 0;
+        }
+        return true;
+    }
+
+    /// Read everything available and process it. Returns false when the
+    /// connection is lost
+    bool Receive(Clock::time_point now)
+    {
+        for (;;) {
+            if (m_in.size() < m_in_len + READ_SIZE)
+                m_in.resize(m_in_len + READ_SIZE);
+            size_t n   = 0;
+            auto   res = curl_easy_recv(m_easy, &m_in[m_in_len], READ_SIZE, &n);
+            if (res == CURLE_AGAIN) return true;
+            if (res != CURLE_OK || !n)
+                return false;
+            m_in_len      += n;
+            m_last_rx      = now;
+            m_ping_pending = false;
+
+            if (m_state.load() == HANDSHAKE && !Handshake())
+                return false;
+            if (m_failed)
+                m_in_pos = m_in_len;
+            else if (m_state.load() >= OPEN)
+                Parse();
+            if (m_state.load() == CLOSED)
+                return true;
+
+            if (m_in_pos == m_in_len)
+                m_in_pos = m_in_len = 0;
+            else if (m_in_pos >= READ_SIZE) {
+                memmove(&m_in[0], &m_in[m_in_pos], m_in_len - m_in_pos);
+                m_in_len -= m_in_pos;
+                m_in_pos  = 0;
+            }
+        }
+    }
+
+    /// Check the server's handshake response once it's complete
+    bool Handshake()
+    {
+        static const char s_end[] = "\r\n\r\n";
+        auto begin = m_in.data();
+        auto end   = std::search(begin, begin + m_in_len, s_end, s_end + 4);
+        if (end == begin + m_in_len)
+            return m_in_len < READ_SIZE;   // Incomplete
+        auto resp = std::string(begin, end);
+        m_in_pos  = size_t(end - begin) + 4;
+
+        if (resp.compare(0, 12, "HTTP/1.1 101") != 0) {
+            snprintf(m_err, sizeof(m_err), "WebSocket handshake failed: %s",
+                     resp.substr(0, resp.find('\r')).c_str());
+            return false;
+        }
+
+        static const char s_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        uint8_t digest[20];
+        auto    key = m_key + s_guid;
+        Sha1(key.c_str(), key.size(), digest);
+        auto accept = Base64(digest, sizeof(digest));
+
+        for (auto p = resp.find("\r\n"); p != std::string::npos; ) {
+            auto e    = resp.find("\r\n", p + 2);
+            auto line = resp.substr(p + 2, e == std::string::npos ? std::string::npos : e - p - 2);
+            p = e;
+            auto colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            auto name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name != "sec-websocket-accept") continue;
+            auto v = line.find_first_not_of(' ', colon + 1);
+            if (v != std::string::npos && line.compare(v, accept.size(), accept) == 0) {
+                m_state.store(OPEN);
+                return true;
+            }
+        }
+        snprintf(m_err, sizeof(m_err), "WebSocket handshake failed: bad Sec-WebSocket-Accept");
+        return false;
+    }
+
+    /// Close the connection on a protocol error, ignoring further input
+    void Fail(uint16_t code)
+    {
+        SendClose(code);
+        m_failed = true;
+        m_in_pos = m_in_len;
+    }
+
+    /// Process complete frames in the input buffer
+    void Parse()
+    {
+        while (!m_failed && (m_state.load() == OPEN || m_state.load() == CLOSING)) {
+            auto p     = reinterpret_cast<uint8_t*>(&m_in[m_in_pos]);
+            auto avail = m_in_len - m_in_pos;
+            if (avail < 2) return;
+
+            bool     fin    = p[0] & 0x80;
+            int      opcode = p[0] & 0x0f;
+            uint64_t len    = p[1] & 0x7f;
+            size_t   hdr    = 2;
+            if (p[1] & 0x80) {
+                Fail(1002);                 // Servers must not mask frames (RFC 6455 5.1)
+                return;
+            }
+            if (len == 126) {
+                if (avail < 4) return;
+                len = uint64_t(p[2]) << 8 | p[3];
+                hdr = 4;
+            } else if (len == 127) {
+                if (avail < 10) return;
+                len = 0;
+                for (int i = 0; i < 8; ++i) len = len << 8 | p[2+i];
+                hdr = 10;
+            }
+            if (len > MAX_MESSAGE || m_msg.data.size() + len > MAX_MESSAGE) {
+                Fail(1009);                 // Message too big
+                return;
+            }
+            if (avail < hdr + len) return;
+
+            auto payload = reinterpret_cast<char*>(p + hdr);
+            m_in_pos += hdr + size_t(len);
+
+            switch (opcode) {
+                case TEXT:
+                case BINARY:
+                    if (m_msg_active) { Fail(1002); return; }
+                    m_msg.type = opcode;
+                    m_msg.data.assign(payload, size_t(len));
+                    m_msg_active = true;
+                    break;
+                case CONTINUATION:
+                    if (!m_msg_active) { Fail(1002); return; }
+                    m_msg.data.append(payload, size_t(len));
+                    break;
+                case PING:
+                    if (m_state.load() == OPEN) Frame(PONG, payload, size_t(len));
+                    continue;
+                case PONG:
+                    continue;
+                case CLOSE:
+                    if (m_state.load() == OPEN)
+                        Frame(CLOSE, payload, std::min<size_t>(size_t(len), 2));
+                    m_state.store(CLOSED);
+                    return;
+                default:
+                    Fail(1002);             // Protocol error
+                    return;
+            }
+            if (fin) {
+                m_msg_active = false;
+                m_queue.Push(m_msg);        // Swaps in the buffer of a consumed message
+                m_msg.data.clear();
+            }
+        }
+    }
+
+    std::string              m_url;
+    std::string              m_key;
+    CURL*                    m_easy;
+    curl_socket_t            m_sock;
+    SpscQueue<WsMessage>     m_queue;
+    std::atomic<int>         m_state;
+    std::atomic<bool>        m_closing;     ///< Close requested by the owner
+
+    std::mutex               m_out_mtx;     ///< Guards output buffer and m_rng
+    std::mt19937             m_rng;         ///< Frame masks
+    std::string              m_out;         ///< Handshake request, then frames
+    size_t                   m_out_pos;     ///< Bytes of m_out already sent
+    size_t                   m_req_len;     ///< Bytes of m_out that may be sent during handshake
+
+    // Only touched by the engine thread
+    std::string              m_in;          ///< Received bytes
+    size_t                   m_in_pos;      ///< Start of unprocessed bytes in m_in
+    size_t                   m_in_len;      ///< End of received bytes in m_in
+    WsMessage                m_msg;         ///< Message being reassembled
+    bool                     m_msg_active;
+    bool                     m_ping_pending;
+    bool                     m_failed;      ///< Protocol error, closing
+    Clock::time_point        m_last_rx;
+    Clock::time_point        m_close_at;
+    char                     m_err[CURL_ERROR_SIZE];
+};
@@ -7,13 +7,34 @@
 //------------------------------------------------------------------------------
 #pragma once
 
+#include <cstddef>
+
 // When building curl-mt4.dll, add BUILDING_MT4CURL pre-processor define
-#ifdef BUILDING_MT4CURL
-    #define MT4EXPORT __declspec(dllexport)
+#ifdef _WIN32
+    #ifdef BUILDING_MT4CURL
+        #define MT4EXPORT __declspec(dllexport)
+    #else
+        #define MT4EXPORT __declspec(dllimport)
+    #endif
+    // MT4 calls DLL functions using the stdcall convention
+    #define MT4CALL   __stdcall
 #else
-    #define MT4EXPORT __declspec(dllimport)
+    #define MT4EXPORT __attribute__((visibility("default")))
+    #define MT4CALL
 #endif
 
+//------------------------------------------------------------------------------
+// Thread safety
+//
+// * All functions may be called concurrently from any number of threads.
+// * Calls on the same handle are serialized: each call sees the handle in the
+//   state left by a complete previous call, and a `CurlExecute()` on one
+//   thread blocks other calls on that handle until it's done. Threads sharing
+//   a handle may therefore read each other's responses; use a handle per
+//   thread (or per chart) to get consistent request/response pairs.
+// * `CurlFinalize()` must not be called while other threads still use the
+//   handle.
+//------------------------------------------------------------------------------
 extern "C" {
 
     enum CurlOptions {
@@ -23,6 +44,55 @@ extern "C" {
         OPT_DEBUG            = 1 << 2,
     };
 
+    /// Destination of diagnostic messages, written by a background thread
+    enum CurlLogSink : int {
+        LOG_SINK_NONE,
+        LOG_SINK_DEBUGGER,  // OutputDebugString() on Windows, stderr elsewhere
+        LOG_SINK_STDERR,
+        LOG_SINK_FILE,      // Rotating log file
+    };
+
+    /// Record requests and responses to a file, or replay responses from it
+    enum CurlReplayMode : int {
+        REPLAY_OFF,
+        REPLAY_RECORD,
+        REPLAY_PLAY,
+    };
+
+    /// Errors returned by `CurlExecute()` in addition to CURLcode values
+    enum CurlError : int {
+        ERR_INVALID_HANDLE = -1,
+        ERR_NO_POST_DATA   = -2,
+        ERR_REPLAY_MISS    = -3,    // No recorded response matches the request
+        ERR_MOCK_MISS      = -4,    // No mock rule matches the request
+        ERR_PENDING        = -5,    // Asynchronous request still in progress
+        ERR_NO_REQUEST     = -6,    // No asynchronous request to collect
+        ERR_CIRCUIT_OPEN   = -7,    // Host's circuit breaker is open, request not sent
+        ERR_RATE_LIMITED   = -8,    // Rate limit would queue the request too long
+    };
+
+    /// Scheduling class of asynchronous requests
+    enum CurlPriority : int {
+        PRIORITY_CRITICAL,          // Orders: jump the queue, reserved slot, throttle bulk
+        PRIORITY_NORMAL,
+        PRIORITY_BULK,              // Downloads, uploads, telemetry
+    };
+
+    /// Type of a WebSocket message
+    enum CurlWsType : int {
+        WS_TEXT   = 1,
+        WS_BINARY = 2,
+    };
+
+    /// Distribution of the synthetic latency of mock responses
+    enum CurlLatencyModel : int {
+        LATENCY_NONE,
+        LATENCY_CONSTANT,           // p1 ms
+        LATENCY_UNIFORM,            // p1..p2 ms
+        LATENCY_NORMAL,             // mean p1 ms, stddev p2 ms
+        LATENCY_LOGNORMAL,          // median p1 ms, shape (sigma) p2
+    };
+
     enum CurlMethod : int {
         GET,
         POST,
@@ -36,74 +106,367 @@ extern "C" {
     using uint       = unsigned int;
 
     /// Initialize CURL library
-    MT4EXPORT CurlHandle __stdcall CurlInit();
+    MT4EXPORT CurlHandle MT4CALL   CurlInit();
     /// Finalize CURL library
-    MT4EXPORT void       __stdcall CurlFinalize(CurlHandle handle);
+    MT4EXPORT void       MT4CALL   CurlFinalize(CurlHandle handle);
 
     /// Set URL prior to calling `CurlExecute()`
-    MT4EXPORT int        __stdcall CurlSetURL     (CurlHandle handle, const char* url);
+    MT4EXPORT int        MT4CALL   CurlSetURL     (CurlHandle handle, const char* url);
     /// Set request timeout in seconds
-    MT4EXPORT int        __stdcall CurlSetTimeout (CurlHandle handle, int timeout_secs);
+    MT4EXPORT int        MT4CALL   CurlSetTimeout (CurlHandle handle, int timeout_secs);
+    /// Tag subsequent requests of this handle with an endpoint name used to
+    /// key latency statistics (pass nullptr or "" to clear)
+    MT4EXPORT void       MT4CALL   CurlSetEndpoint(CurlHandle handle, const char* tag);
+    /// Set '\n' delimited equivalent base URLs ("https://host[:port][/path]")
+    /// the handle's requests are routed to (nullptr or "" - none). Each
+    /// request goes to the mirror with the lowest moving average latency,
+    /// penalized by its failure rate; a mirror not used for 10s gets the
+    /// next request, to track its latency. A URL set by `CurlSetURL()` that
+    /// is a path ("/v1/quotes") is appended to the mirror, and one starting
+    /// with any of the mirrors has that part replaced. Mirror statistics
+    /// are shared by all handles of the process
+    MT4EXPORT void       MT4CALL   CurlSetMirrors (CurlHandle handle, const char* base_urls);
+    /// Return the index of the mirror the handle's last request was routed
+    /// to, or -1 if none
+    MT4EXPORT int        MT4CALL   CurlLastMirror (CurlHandle handle);
+    /// Record requests and responses of this handle to `path` (REPLAY_RECORD),
+    /// or serve responses recorded in `path` without network access
+    /// (REPLAY_PLAY). Replayed requests are matched by method, URL and body;
+    /// a request that wasn't recorded fails with ERR_REPLAY_MISS.
+    /// Returns -1 if the file can't be opened
+    MT4EXPORT int        MT4CALL   CurlSetReplay  (CurlHandle handle, CurlReplayMode mode, const char* path);
+    /// Open a Server-Sent Events stream at `url` (using the handle's headers)
+    /// kept open by a background thread. Events are parsed as they arrive
+    /// and queued (up to 4096, newer events are dropped when full). A closed
+    /// or failed connection is reopened with `Last-Event-ID` after the delay
+    /// requested by the server (default 3s), backing off exponentially up to
+    /// 60s while it keeps failing. A 204, a 4xx other than 408/429, or a
+    /// response that isn't `text/event-stream` closes the stream (see
+    /// `CurlEventStreamStatus()`). Replaces a stream already open
+    MT4EXPORT int        MT4CALL   CurlOpenEventStream(CurlHandle handle, const char* url);
+    /// Dequeue the next event, copying its type to `event` and its data to
+    /// `data` (NUL-terminated). Returns the length of the data, or the
+    /// required length if it doesn't fit in `data_size` (the event is then
+    /// kept). Returns -1 if there's no event and -2 if the stream is closed
+    MT4EXPORT int        MT4CALL   CurlNextEvent  (CurlHandle handle, char* event, int event_size,
+                                                   char* data, int data_size);
+    /// Close the handle's event stream
+    MT4EXPORT void       MT4CALL   CurlCloseEventStream(CurlHandle handle);
+    /// HTTP status of the event stream's last response, or 0 if none was
+    /// received. After `CurlNextEvent()` returns -2 this tells why the server
+    /// closed the stream (200 means the response wasn't an event stream)
+    MT4EXPORT int        MT4CALL   CurlEventStreamStatus(CurlHandle handle);
+    /// Stream a newline-delimited JSON response from `url` (using the
+    /// handle's headers) on a background thread. Each record (line) is
+    /// queued as soon as it's received (up to 4096, newer records are
+    /// dropped when full). Replaces a stream already open
+    MT4EXPORT int        MT4CALL   CurlOpenJsonStream(CurlHandle handle, const char* url);
+    /// Dequeue the next record into `buf` (NUL-terminated). Returns its
+    /// length, or the required length if it doesn't fit in `size` (the
+    /// record is then kept). Returns -1 if there's no record and -2 if the
+    /// response ended and all its records were read
+    MT4EXPORT int        MT4CALL   CurlNextRecord (CurlHandle handle, char* buf, int size);
+    /// Close the handle's NDJSON stream
+    MT4EXPORT void       MT4CALL   CurlCloseJsonStream(CurlHandle handle);
+    /// Tell how the NDJSON stream's response ended, e.g. once
+    /// `CurlNextRecord()` returns -2. Returns its CURLcode (0 if it was read
+    /// to the end) or -1 while it's being read, and sets `code` to its HTTP
+    /// status (records of a non-2xx response aren't queued)
+    MT4EXPORT int        MT4CALL   CurlJsonStreamStatus(CurlHandle handle, int* code);
+    /// Long-poll `url` (GET, using the handle's headers): a background thread
+    /// reissues the request as soon as each response arrives and queues
+    /// response bodies (up to 1024, newer ones are dropped when full).
+    /// `max_wait` is the longest time in seconds the server holds a request;
+    /// a request held longer is reissued. 204 and 304 responses aren't
+    /// queued, and with `on_change_only` neither is a body identical to the
+    /// previous one. Failed requests (including 4xx and 5xx responses), and
+    /// requests answered within 1s with no new body (the server isn't
+    /// holding them), are retried with a backoff of up to 30s. Requests are
+    /// sent at most every 100ms. Replaces a long-poll already running
+    MT4EXPORT int        MT4CALL   CurlLongPoll   (CurlHandle handle, const char* url, int max_wait,
+                                                   int on_change_only);
+    /// Dequeue the next long-poll response body into `buf` (NUL-terminated).
+    /// Returns its length, or the required length if it doesn't fit in
+    /// `size` (the body is then kept). Returns -1 if there's no body and -2
+    /// if no long-poll is running
+    MT4EXPORT int        MT4CALL   CurlNextPoll   (CurlHandle handle, char* buf, int size);
+    /// Stop the handle's long-poll
+    MT4EXPORT void       MT4CALL   CurlStopLongPoll(CurlHandle handle);
+    /// Open a WebSocket connection to `url` (ws:// or wss://, using the
+    /// handle's headers in the handshake) kept open by a background thread,
+    /// which answers pings and pings a connection silent for 30s. Received
+    /// messages are reassembled and queued (up to 4096, newer messages are
+    /// dropped when full). Replaces a connection already open
+    MT4EXPORT int        MT4CALL   CurlWsOpen     (CurlHandle handle, const char* url);
+    /// Queue a message of `len` bytes (-1 for a NUL-terminated string) to be
+    /// sent. Returns -2 if the connection is closed
+    MT4EXPORT int        MT4CALL   CurlWsSend     (CurlHandle handle, const char* data, int len,
+                                                   CurlWsType type=WS_TEXT);
+    /// Dequeue the next message into `buf` (NUL-terminated) and set `type`.
+    /// Returns its length, or the required length if it doesn't fit in
+    /// `size` (the message is then kept). Returns -1 if there's no message
+    /// and -2 if the connection is closed
+    MT4EXPORT int        MT4CALL   CurlWsRecv     (CurlHandle handle, char* buf, int size, int* type);
+    /// Close the handle's WebSocket connection
+    MT4EXPORT void       MT4CALL   CurlWsClose    (CurlHandle handle);
+    /// Serve requests of this handle from in-memory rules instead of the
+    /// network. A request whose method (-1 for any) and URL match the glob
+    /// `url_pattern` ('*', '?') gets `status`, '\n' delimited `headers` and
+    /// `body` of the first matching rule. Requests that match no rule fail
+    /// with ERR_MOCK_MISS. Mocking is active while the handle has rules
+    MT4EXPORT int        MT4CALL   CurlMockAdd    (CurlHandle handle, int method, const char* url_pattern,
+                                                   int status, const char* headers, const char* body);
+    /// Delay mock responses by a latency sampled from `model` (fixed seed).
+    /// Delays beyond the request timeout fail with CURLE_OPERATION_TIMEDOUT
+    MT4EXPORT void       MT4CALL   CurlMockLatency(CurlHandle handle, CurlLatencyModel model,
+                                                   double p1_ms, double p2_ms);
+    /// Remove all mock rules of this handle, which disables mocking
+    MT4EXPORT void       MT4CALL   CurlMockClear  (CurlHandle handle);
     /// Add '\n' delimited request headers
-    MT4EXPORT void       __stdcall CurlAddHeaders (CurlHandle handle, const char* headers);
+    MT4EXPORT void       MT4CALL   CurlAddHeaders (CurlHandle handle, const char* headers);
     /// Add a single request header
-    MT4EXPORT void       __stdcall CurlAddHeader  (CurlHandle handle, const char* header);
+    MT4EXPORT void       MT4CALL   CurlAddHeader  (CurlHandle handle, const char* header);
     /// Execute a request on the server
     /// @param code       resulting code (optional if passed nullptr) returned by the server (200 = success)
     /// @param res_length resulting response body length (optional if passed nullptr)
     /// @param opts       request options (OR'd CurlOptions)
     /// @param post_data  request body for POST requests
-    MT4EXPORT int        __stdcall CurlExecute    (CurlHandle handle, int* code, int* res_length,
+    MT4EXPORT int        MT4CALL   CurlExecute    (CurlHandle handle, int* code, int* res_length,
                                                    CurlMethod method=GET,
                                                    uint opts=uint(OPT_NONE), const char* post_data=nullptr,
                                                    int timeout_secs=10);
+    /// Start a request like `CurlExecute()` on a background thread and return
+    /// immediately. Failed attempts are retried there according to the
+    /// handle's retry policy (see `CurlSetRetry()`), so the caller never
+    /// sleeps. Returns 0, or ERR_PENDING if the handle's previous
+    /// asynchronous request hasn't completed
+    MT4EXPORT int        MT4CALL   CurlExecuteAsync(CurlHandle handle, CurlMethod method=GET,
+                                                   uint opts=uint(OPT_NONE), const char* post_data=nullptr,
+                                                   int timeout_secs=10);
+    /// Collect the result of `CurlExecuteAsync()`: returns ERR_PENDING while
+    /// it's in progress, then its CURLcode, setting `code` and `res_length`
+    /// like `CurlExecute()` and making the response available to
+    /// `CurlGetData()` and `CurlGetRespHeader()`. Returns ERR_NO_REQUEST if
+    /// there's nothing to collect
+    MT4EXPORT int        MT4CALL   CurlAsyncResult(CurlHandle handle, int* code, int* res_length);
+    /// Set the retry policy of the handle's asynchronous requests. A request
+    /// is attempted up to `max_attempts` times while it fails with one of
+    /// the comma separated `retry_on` CURLcodes (< 100) or HTTP statuses
+    /// (nullptr or "" - connection errors, timeouts, 408, 429, 500, 502,
+    /// 503, 504). Retry `n` waits `base_ms * 2^(n-1)`, at most `max_ms`,
+    /// of which a `jitter` fraction (0..1) is random, unless the response
+    /// has a `Retry-After` header (which is not retried if longer than
+    /// `max_ms`). POST requests are only retried if they have an
+    /// `Idempotency-Key` header. `max_attempts` of 1 disables retries
+    MT4EXPORT void       MT4CALL   CurlSetRetry   (CurlHandle handle, int max_attempts, int base_ms,
+                                                   int max_ms, double jitter, const char* retry_on);
+    /// Give each request of the handle (`CurlExecute()` or asynchronous) a
+    /// deadline `deadline_ms` after it's made, which covers redirects,
+    /// retries and time spent queued behind rate limits or for a slot: no
+    /// attempt runs past it, and a request that misses it fails with
+    /// CURLE_OPERATION_TIMEDOUT. It doesn't extend the `timeout_secs` of an
+    /// attempt. 0 (the default) - no deadline
+    MT4EXPORT void       MT4CALL   CurlSetDeadline(CurlHandle handle, int deadline_ms);
+    /// Cancel the requests of the handle in progress, which fail with
+    /// CURLE_ABORTED_BY_CALLBACK. Unlike other functions it doesn't wait
+    /// for a `CurlExecute()` on another thread, so it may be called from a
+    /// watchdog to abort a stuck request; its transfer stops within a second
+    MT4EXPORT void       MT4CALL   CurlCancel     (CurlHandle handle);
+    /// Set the scheduling class of the handle's asynchronous requests
+    /// (default PRIORITY_NORMAL), see `CurlSetScheduling()`
+    MT4EXPORT void       MT4CALL   CurlSetPriority(CurlHandle handle, CurlPriority priority);
+    /// Allow up to `host_slots` concurrent asynchronous requests per host
+    /// (0 - unlimited, the default). Requests beyond that wait for a slot,
+    /// critical ones first, and if `host_slots` >= 2, one slot is kept for
+    /// critical requests.
+    /// While a critical request is in progress, bulk transfers are limited
+    /// to `bulk_throttle_bps` bytes/s each way (0 - not throttled)
+    MT4EXPORT void       MT4CALL   CurlSetScheduling(int host_slots, int bulk_throttle_bps);
+    /// Coalesce the handle's GET requests (`enable` != 0) with identical
+    /// ones (same URL, headers and options) of any coalescing handle of the
+    /// process: a request made while an identical one is in flight waits
+    /// for it and receives the same response instead of being sent. If the
+    /// request waited for is cancelled, or fails without a response (past
+    /// its deadline, rate limited), the waiting ones are sent after all.
+    /// Disabled by default
+    MT4EXPORT void       MT4CALL   CurlSetCoalesce(CurlHandle handle, int enable);
+    /// Hedge the handle's asynchronous GET requests: if an attempt has no
+    /// response after `delay_ms`, an identical request is sent and the first
+    /// response is used while the other request is aborted. A negative
+    /// `delay_ms` uses the host's running p95 latency (once enough requests
+    /// were timed), 0 (the default) disables hedging
+    MT4EXPORT void       MT4CALL   CurlSetHedge   (CurlHandle handle, int delay_ms);
+    /// Configure the circuit breaker of `host` ("host[:port]" as in the URL),
+    /// or the default of all other hosts if `host` is nullptr or "". After
+    /// `threshold` consecutive transport errors or 5xx responses, requests
+    /// to the host fail with ERR_CIRCUIT_OPEN without being sent for
+    /// `cooldown_ms`. Then up to `probes` requests are let through: a
+    /// success closes the breaker, a failure opens it again. A `threshold`
+    /// of 0 (the default) disables the breaker
+    MT4EXPORT void       MT4CALL   CurlSetBreaker (const char* host, int threshold, int cooldown_ms,
+                                                   int probes=1);
+    /// Return the state of the circuit breaker of `host`: 0 - closed,
+    /// 1 - open, 2 - half-open (probing), or -1 if `host` is empty
+    MT4EXPORT int        MT4CALL   CurlBreakerState(const char* host);
+    /// Time requests to `host` ("host[:port]" as in the URL) out after
+    /// `multiplier` times its p99 latency over the last minute, but no
+    /// sooner than `floor_ms` and no later than `ceiling_ms`, instead of
+    /// after the `timeout_secs` of `CurlExecute()`. The connect timeout is
+    /// capped by it too. The timeout follows the host's latency as it
+    /// changes; until 20 requests to the host are timed, `timeout_secs`
+    /// applies. If `host` is nullptr or "", configures all other hosts.
+    /// A `multiplier` <= 0 (the default) disables adaptive timeouts
+    MT4EXPORT void       MT4CALL   CurlSetAdaptiveTimeout(const char* host, double multiplier,
+                                                   int floor_ms, int ceiling_ms);
+    /// Return the current adaptive timeout of `host` in ms, 0 if there's
+    /// none, or -1 if `host` is empty
+    MT4EXPORT int        MT4CALL   CurlAdaptiveTimeout(const char* host);
+    /// Limit requests to `host` ("host[:port]" as in the URL) whose path
+    /// starts with `prefix` (nullptr or "" - all requests to the host) to
+    /// `rate` per second with bursts of up to `burst` requests. Requests
+    /// over the limit are queued: `CurlExecute()` sleeps and asynchronous
+    /// requests are delayed, but a request that would wait longer than
+    /// `max_delay_ms` fails with ERR_RATE_LIMITED. A request is subject to
+    /// its host's limit and to the one with the longest matching prefix.
+    /// Critical asynchronous requests (see `CurlSetPriority()`) go ahead of
+    /// the queued ones, waiting for one token at most. A `rate` <= 0 removes the limit. Returns -1 if `host` is empty
+    MT4EXPORT int        MT4CALL   CurlSetRateLimit(const char* host, const char* prefix, double rate,
+                                                   int burst, int max_delay_ms);
+    /// Get the tokens left in a rate limit's bucket: a negative level is the
+    /// number of requests queued. Returns -1 if there's no such limit
+    MT4EXPORT int        MT4CALL   CurlRateLimitLevel(const char* host, const char* prefix, double* tokens);
     /// Return response body length
-    MT4EXPORT int        __stdcall CurlGetDataSize(CurlHandle handle);
+    MT4EXPORT int        MT4CALL   CurlGetDataSize(CurlHandle handle);
     /// Return response data, where `buf` size must be pre-allocated to `res_length`
     /// returned by `CurlExecute()`
-    MT4EXPORT int        __stdcall CurlGetData    (CurlHandle handle, char* buf, int size);
+    MT4EXPORT int        MT4CALL   CurlGetData    (CurlHandle handle, char* buf, int size);
     /// Get count of response headers
-    MT4EXPORT size_t    __stdcall  CurlTotRespHeaders(CurlHandle handle);
+    MT4EXPORT size_t    MT4CALL    CurlTotRespHeaders(CurlHandle handle);
     /// Get `idx`th response header.
     /// If the header's length is greater than `buflen`, the function doesn't update `buf`.
     /// Return the actual length of the header or -1 if `idx` is invalid.
-    MT4EXPORT int        __stdcall CurlGetRespHeader(void* handle, int idx, char* key, size_t buflen);
+    MT4EXPORT int        MT4CALL   CurlGetRespHeader(void* handle, int idx, char* key, size_t buflen);
     /// Get description of the `err` code
-    MT4EXPORT int        __stdcall CurlLastError  (CurlHandle handle, int err, char* errs, int max_size);
-    /// Set debug level
-    MT4EXPORT void       __stdcall CurlDbgLevel   (CurlHandle handle, int level);
+    MT4EXPORT int        MT4CALL   CurlLastError  (CurlHandle handle, int err, char* errs, int max_size);
+    /// Select where diagnostic messages are written (default: LOG_SINK_DEBUGGER).
+    /// For LOG_SINK_FILE, `path` is rotated when it exceeds `max_file_size`
+    /// bytes keeping up to `max_files` old files (0 - use defaults: 10 MB, 5).
+    /// Returns -1 if the log file can't be opened
+    MT4EXPORT int        MT4CALL   CurlSetLogSink (CurlLogSink sink, const char* path=nullptr,
+                                                   int max_file_size=0, int max_files=0);
+    /// Set debug level: 1 - trace events, 2 - also dump sent/received data
+    /// as ASCII, 3 - dump data in hex and ASCII
+    MT4EXPORT void       MT4CALL   CurlDbgLevel   (CurlHandle handle, int level);
+    /// Set capacity in bytes of the handle's trace ring (default 1 MB).
+    /// Oldest trace events are discarded when the ring is full
+    MT4EXPORT void       MT4CALL   CurlDbgBufSize (CurlHandle handle, int size);
+    /// Set max number of data bytes dumped per trace event (default 64 KB)
+    MT4EXPORT void       MT4CALL   CurlDbgDumpLimit(CurlHandle handle, int size);
     /// Return size of buffer needed to fetch debug info
-    MT4EXPORT int        __stdcall CurlDbgInfoSize(CurlHandle handle);
+    MT4EXPORT int        MT4CALL   CurlDbgInfoSize(CurlHandle handle);
     /// Return debug info where `buf` size must be pre-allocated to length returned by `CurlDbgInfoSize()`
-    MT4EXPORT int        __stdcall CurlDbgInfo    (CurlHandle handle, char* buf, int size);
+    MT4EXPORT int        MT4CALL   CurlDbgInfo    (CurlHandle handle, char* buf, int size);
+    /// Incrementally read the debug log. Copies to `buf` (NUL-terminated) the
+    /// trace events logged after the position stored in `*cursor` (start
+    /// with 0), advances the cursor and discards the events read.
+    /// Returns the number of bytes copied (0 when there's nothing new)
+    MT4EXPORT int        MT4CALL   CurlDbgRead    (CurlHandle handle, int* cursor, char* buf, int size);
+    /// Return a CSV snapshot of process-wide latency statistics per host and
+    /// per endpoint: "type,key,count,errors,p50,p90,p99,p99.9,max" (usec).
+    /// Returns the length of the snapshot. If it doesn't fit in `size` (with
+    /// the NUL terminator), nothing is copied and the length tells the size
+    /// of the buffer to retry with
+    MT4EXPORT int        MT4CALL   CurlStatsSnapshot(char* buf, int size);
+    /// Reset process-wide latency statistics
+    MT4EXPORT void       MT4CALL   CurlStatsReset ();
 
 #ifndef NO_CURLMT4_UNICODE_API
     /// Set URL prior to calling `CurlExecute()`
-    MT4EXPORT int        __stdcall CurlSetURLW    (CurlHandle handle, const wchar_t* url);
+    MT4EXPORT int        MT4CALL   CurlSetURLW    (CurlHandle handle, const wchar_t* url);
+    /// Tag subsequent requests with an endpoint name for latency statistics
+    MT4EXPORT void       MT4CALL   CurlSetEndpointW(CurlHandle handle, const wchar_t* tag);
+    /// Set the mirror base URLs requests are routed to (see `CurlSetMirrors()`)
+    MT4EXPORT void       MT4CALL   CurlSetMirrorsW(CurlHandle handle, const wchar_t* base_urls);
+    /// Record requests to or replay responses from `path` (see `CurlSetReplay()`)
+    MT4EXPORT int        MT4CALL   CurlSetReplayW (CurlHandle handle, CurlReplayMode mode, const wchar_t* path);
+    /// Open a Server-Sent Events stream (see `CurlOpenEventStream()`)
+    MT4EXPORT int        MT4CALL   CurlOpenEventStreamW(CurlHandle handle, const wchar_t* url);
+    /// Dequeue the next event of the stream (see `CurlNextEvent()`)
+    MT4EXPORT int        MT4CALL   CurlNextEventW (CurlHandle handle, wchar_t* event, int event_size,
+                                                   wchar_t* data, int data_size);
+    /// Stream a newline-delimited JSON response (see `CurlOpenJsonStream()`)
+    MT4EXPORT int        MT4CALL   CurlOpenJsonStreamW(CurlHandle handle, const wchar_t* url);
+    /// Dequeue the next record of the stream (see `CurlNextRecord()`)
+    MT4EXPORT int        MT4CALL   CurlNextRecordW(CurlHandle handle, wchar_t* buf, int size);
+    /// Long-poll `url` in the background (see `CurlLongPoll()`)
+    MT4EXPORT int        MT4CALL   CurlLongPollW  (CurlHandle handle, const wchar_t* url, int max_wait,
+                                                   int on_change_only);
+    /// Dequeue the next long-poll response body (see `CurlNextPoll()`)
+    MT4EXPORT int        MT4CALL   CurlNextPollW  (CurlHandle handle, wchar_t* buf, int size);
+    /// Open a WebSocket connection (see `CurlWsOpen()`)
+    MT4EXPORT int        MT4CALL   CurlWsOpenW    (CurlHandle handle, const wchar_t* url);
+    /// Queue a text message to be sent (see `CurlWsSend()`)
+    MT4EXPORT int        MT4CALL   CurlWsSendW    (CurlHandle handle, const wchar_t* text);
+    /// Dequeue the next message (see `CurlWsRecv()`)
+    MT4EXPORT int        MT4CALL   CurlWsRecvW    (CurlHandle handle, wchar_t* buf, int size, int* type);
+    /// Add a mock response rule (see `CurlMockAdd()`)
+    MT4EXPORT int        MT4CALL   CurlMockAddW   (CurlHandle handle, int method, const wchar_t* url_pattern,
+                                                   int status, const wchar_t* headers, const wchar_t* body);
     /// Add '\n' delimited request headers
-    MT4EXPORT void       __stdcall CurlAddHeadersW(CurlHandle handle, const wchar_t* headers);
+    MT4EXPORT void       MT4CALL   CurlAddHeadersW(CurlHandle handle, const wchar_t* headers);
     /// Add a single request header
-    MT4EXPORT void       __stdcall CurlAddHeaderW (CurlHandle handle, const wchar_t* header);
+    MT4EXPORT void       MT4CALL   CurlAddHeaderW (CurlHandle handle, const wchar_t* header);
     /// Get `idx`th response header.
     /// If the header's length is greater than `buflen`, the function doesn't update `buf`.
     /// Return the actual length of the header or -1 if `idx` is invalid.
-    MT4EXPORT int       __stdcall CurlGetRespHeaderW(CurlHandle handle, int idx, wchar_t* buf, size_t buflen);
+    MT4EXPORT int       MT4CALL   CurlGetRespHeaderW(CurlHandle handle, int idx, wchar_t* buf, size_t buflen);
 
     /// Execute a request on the server
     /// @param code       resulting code (optional if passed nullptr) returned by the server (200 = success)
     /// @param res_length resulting response body length (optional if passed nullptr)
     /// @param opts       request options (OR'd CurlOptions)
     /// @param post_data  request body for POST requests
-    MT4EXPORT int        __stdcall CurlExecuteW   (CurlHandle handle, int* code, int* res_length,
+    MT4EXPORT int        MT4CALL   CurlExecuteW   (CurlHandle handle, int* code, int* res_length,
                                                    CurlMethod method = GET,
                                                    unsigned int opts = 0, const wchar_t* post_data = nullptr,
                                                    int  timeout_secs = 10);
+    /// Start a request on a background thread (see `CurlExecuteAsync()`)
+    MT4EXPORT int        MT4CALL   CurlExecuteAsyncW(CurlHandle handle, CurlMethod method = GET,
+                                                   unsigned int opts = 0, const wchar_t* post_data = nullptr,
+                                                   int  timeout_secs = 10);
+    /// Set the retry policy of asynchronous requests (see `CurlSetRetry()`)
+    MT4EXPORT void       MT4CALL   CurlSetRetryW  (CurlHandle handle, int max_attempts, int base_ms,
+                                                   int max_ms, double jitter, const wchar_t* retry_on);
+    /// Configure the circuit breaker of a host (see `CurlSetBreaker()`)
+    MT4EXPORT void       MT4CALL   CurlSetBreakerW(const wchar_t* host, int threshold, int cooldown_ms,
+                                                   int probes=1);
+    /// Return the state of the circuit breaker of a host (see `CurlBreakerState()`)
+    MT4EXPORT int        MT4CALL   CurlBreakerStateW(const wchar_t* host);
+    /// Adapt the timeout of requests to a host (see `CurlSetAdaptiveTimeout()`)
+    MT4EXPORT void       MT4CALL   CurlSetAdaptiveTimeoutW(const wchar_t* host, double multiplier,
+                                                   int floor_ms, int ceiling_ms);
+    /// Return the adaptive timeout of a host (see `CurlAdaptiveTimeout()`)
+    MT4EXPORT int        MT4CALL   CurlAdaptiveTimeoutW(const wchar_t* host);
+    /// Limit the request rate to a host (see `CurlSetRateLimit()`)
+    MT4EXPORT int        MT4CALL   CurlSetRateLimitW(const wchar_t* host, const wchar_t* prefix, double rate,
+                                                   int burst, int max_delay_ms);
+    /// Get the level of a rate limit (see `CurlRateLimitLevel()`)
+    MT4EXPORT int        MT4CALL   CurlRateLimitLevelW(const wchar_t* host, const wchar_t* prefix,
+                                                   double* tokens);
     /// Return response data, where `buf` size must be pre-allocated to `res_length` returned by `CurlExecute()`
-    MT4EXPORT int        __stdcall CurlGetDataW   (CurlHandle handle, wchar_t* buf, int size);
+    MT4EXPORT int        MT4CALL   CurlGetDataW   (CurlHandle handle, wchar_t* buf, int size);
     /// Get description of the `err` code
-    MT4EXPORT int        __stdcall CurlLastErrorW (CurlHandle handle, int err, wchar_t* errs, int max_size);
+    MT4EXPORT int        MT4CALL   CurlLastErrorW (CurlHandle handle, int err, wchar_t* errs, int max_size);
     /// Return debug info where `buf` size must be pre-allocated to length returned by `CurlDbgInfoSize()`
-    MT4EXPORT int        __stdcall CurlDbgInfoW   (CurlHandle handle, wchar_t* buf, int size);
+    MT4EXPORT int        MT4CALL   CurlDbgInfoW   (CurlHandle handle, wchar_t* buf, int size);
+    /// Select where diagnostic messages are written (see `CurlSetLogSink()`)
+    MT4EXPORT int        MT4CALL   CurlSetLogSinkW(CurlLogSink sink, const wchar_t* path=nullptr,
+                                                   int max_file_size=0, int max_files=0);
+    /// Incrementally read the debug log (see `CurlDbgRead()`)
+    MT4EXPORT int        MT4CALL   CurlDbgReadW   (CurlHandle handle, int* cursor, wchar_t* buf, int size);
+    /// Return latency statistics snapshot (see `CurlStatsSnapshot()`). If
+    /// `buf` is too small, nothing is copied and the required length is returned
+    MT4EXPORT int        MT4CALL   CurlStatsSnapshotW(wchar_t* buf, int size);
 #endif
 
 } // extern
\ No newline at end of file